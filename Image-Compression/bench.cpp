@@ -0,0 +1,329 @@
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+#include "src/codec.h"
+
+// Codec benchmark: encodes and decodes every image of a corpus at several
+// QFs and reports the time spent in each stage, throughput, bits per pixel
+// and PSNR, SSIM and MS-SSIM (imageMetrics) as JSON. The images go through
+// the library Encoder and Decoder, which time their own stages, with the
+// file I/O of encode.exe and decode.exe; one Encoder and one Decoder serve
+// the whole run, keeping their buffers. The fastest of `-runs` repetitions
+// of each stage is kept.
+
+using Clock = chrono::steady_clock;
+
+struct BenchImage {
+    string name;
+    string path;
+    int width, height;
+};
+
+static double elapsedMs(Clock::time_point& t) {
+    Clock::time_point now = Clock::now();
+    double ms = chrono::duration<double, milli>(now - t).count();
+    t = now;
+    return ms;
+}
+
+static void keepBest(StageTimes& best, const StageTimes& t, bool first) {
+    if (first) {
+        best = t;
+        return;
+    }
+    best.io = min(best.io, t.io);
+    best.color = min(best.color, t.color);
+    best.dct = min(best.dct, t.dct);
+    best.entropy = min(best.entropy, t.entropy);
+    best.total = min(best.total, t.total);
+}
+
+// Deterministic synthetic test images: 0 smooth shading, 1 fine texture
+// with noise, 2 flat regions with hard edges
+static vector<unsigned char> syntheticImage(int width, int height, int channels, int kind) {
+    vector<unsigned char> img(size_t(width) * height * channels);
+    uint32_t seed = 12345u + kind;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < channels; ++c) {
+                seed = seed * 1664525u + 1013904223u;
+                int noise = int(seed >> 24) - 128;
+                double v;
+                if (kind == 0)
+                    v = 128 + 90 * sin((x + 40 * c) / 57.0) * cos(y / 41.0) + noise / 32.0;
+                else if (kind == 1)
+                    v = 128 + 60 * sin(x * 0.9 + c) * sin(y * 0.7) + noise / 2.0;
+                else
+                    v = ((x / 48 + y / 32 + c) % 3) * 100 + 20 + noise / 16.0;
+                img[(size_t(y) * width + x) * channels + c] = static_cast<unsigned char>(clamp(int(v), 0, 255));
+            }
+        }
+    }
+    return img;
+}
+
+static bool writeFile(const string& path, const unsigned char* data, size_t size) {
+    ofstream os(path, ios::binary);
+    os.write(reinterpret_cast<const char*>(data), size);
+    return static_cast<bool>(os);
+}
+
+// Encode `img.path` into `codedFile` with `enc`, as encode.exe does: the raw
+// image is mapped, coded in memory and written through a mapped output file.
+// `coded` is the encoder's output buffer, grown as needed and reused by the
+// next runs. Adds the stage times to `t`; prints a message and returns false
+// if a stage fails.
+static bool encodeRun(Encoder& enc, const BenchImage& img, Sampling sampling, const string& codedFile,
+                      vector<unsigned char>& coded, size_t& fileSize, StageTimes& t) {
+    Clock::time_point clock = Clock::now();
+    MappedFile raw;
+    if (!raw.open(img.path))
+        return false;
+    if (raw.size() < size_t(img.width) * img.height * (sampling == GRAY ? 1 : 3)) {
+        cerr << "File too short: " << img.path << endl;
+        return false;
+    }
+    t.io += elapsedMs(clock);
+
+    enc.times = &t;
+    fileSize = enc.encode(raw.data(), img.width, img.height, sampling, coded.data(), coded.size());
+    if (fileSize > coded.size()) {
+        coded.resize(fileSize);
+        fileSize = enc.encode(raw.data(), img.width, img.height, sampling, coded.data(), coded.size());
+    }
+    enc.times = nullptr;
+    if (fileSize == 0) {
+        cerr << "Cannot encode " << img.path << endl;
+        return false;
+    }
+    elapsedMs(clock);
+
+    MappedOutput out;
+    if (!out.create(codedFile, fileSize))
+        return false;
+    memcpy(out.data(), coded.data(), fileSize);
+    if (!out.close())
+        return false;
+    t.io += elapsedMs(clock);
+    return true;
+}
+
+// Decode `codedFile` into `rawFile` with `dec`, as decode.exe does: the
+// pixels are decoded straight into the mapped output file, and copied to
+// `image` for the quality metrics outside the timed stages. Adds the stage
+// times to `t`; prints a message and returns false if a stage fails.
+static bool decodeRun(Decoder& dec, const string& codedFile, const string& rawFile, vector<unsigned char>& image,
+                      StageTimes& t) {
+    Clock::time_point clock = Clock::now();
+    MappedFile data;
+    if (!data.open(codedFile))
+        return false;
+    ImageHeader info;
+    if (!dec.readInfo(data.data(), data.size(), info)) {
+        cerr << "Invalid file header: " << codedFile << endl;
+        return false;
+    }
+    MappedOutput out;
+    if (!out.create(rawFile, Decoder::decodedSize(info)))
+        return false;
+    t.io += elapsedMs(clock);
+
+    dec.times = &t;
+    size_t size = dec.decode(data.data(), data.size(), out.data(), out.size());
+    dec.times = nullptr;
+    if (size == 0) {
+        cerr << "Cannot decode " << codedFile << endl;
+        return false;
+    }
+    elapsedMs(clock);
+
+    image.assign(out.data(), out.data() + size);
+    Clock::time_point io = Clock::now();
+    if (!out.close())
+        return false;
+    t.io += elapsedMs(io);
+    return true;
+}
+
+static string jsonString(const string& s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static void jsonStages(ostream& os, const char* name, const StageTimes& t, double megabytes) {
+    os << "      \"" << name << "\": {\"io_ms\": " << t.io << ", \"color_ms\": " << t.color
+       << ", \"dct_ms\": " << t.dct << ", \"entropy_ms\": " << t.entropy
+       << ", \"total_ms\": " << t.total << ", \"mb_per_s\": " << megabytes / (t.total / 1000.0) << "}";
+}
+
+int main(int argc, char* argv[]) {
+    vector<string> inputFiles;
+    string outputFile;              // JSON report (default: standard output)
+    string tmpFile = "bench.tmp";   // Scratch file prefix for the coded and decoded images
+    vector<int> qualities = {10, 50, 90};
+    Sampling sampling = YUV420;
+    bool optimize = false;
+    EntropyCoder coder = HUFFMAN;
+    int restart = 0;                // MCU rows per restart slice (0: one slice)
+    int threads = 1;                // Threads coding the slices (0: all cores)
+    bool simd = true;
+    int width = 512, height = 512;
+    int runs = 3;
+    int generate = 3;               // Synthetic images used when no input is given
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-o") == 0) {
+            outputFile = argv[++i];
+        } else if (strcmp(argv[i], "-qf") == 0) {
+            qualities.clear();                       // Comma-separated list
+            stringstream list(argv[++i]);
+            for (string q; getline(list, q, ',');)
+                qualities.push_back(clamp(atoi(q.c_str()), 1, 100));
+        } else if (strcmp(argv[i], "-c") == 0) {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "gray") == 0) sampling = GRAY;
+            else if (strcmp(mode, "422") == 0) sampling = YUV422;
+            else if (strcmp(mode, "444") == 0) sampling = YUV444;
+        } else if (strcmp(argv[i], "-w") == 0) {
+            width = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-h") == 0) {
+            height = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-runs") == 0) {
+            runs = max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-gen") == 0) {
+            generate = max(0, min(3, atoi(argv[++i])));
+        } else if (strcmp(argv[i], "-tmp") == 0) {
+            tmpFile = argv[++i];
+        } else if (strcmp(argv[i], "-optimize") == 0) {
+            optimize = true;
+        } else if (strcmp(argv[i], "-entropy") == 0) {
+            coder = strcmp(argv[++i], "rans") == 0 ? RANS : HUFFMAN;
+        } else if (strcmp(argv[i], "-restart") == 0) {
+            restart = max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            threads = max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-nosimd") == 0) {
+            simd = false;
+        } else if (strcmp(argv[i], "-fixed") == 0) {
+            setFixedPoint(true);
+        } else if (argv[i][0] != '-') {
+            inputFiles.push_back(argv[i]);
+        }
+    }
+
+    if (!validImageSize(width, height) || qualities.empty()) {
+        cerr << "Invalid image size or QF list.\n";
+        return 1;
+    }
+    simd = setSimd(simd);
+    const bool grayscale = sampling == GRAY;
+    const int channels = grayscale ? 1 : 3;
+    const size_t rawSize = size_t(width) * height * channels;
+
+    // Corpus: the given raw files, or synthetic images written to scratch files
+    vector<BenchImage> corpus;
+    vector<string> scratch = {tmpFile + ".jpg", tmpFile + ".out.raw"};
+    for (const string& f : inputFiles)
+        corpus.push_back({f, f, width, height});
+    if (inputFiles.empty()) {
+        static const char* kinds[3] = {"synthetic-smooth", "synthetic-texture", "synthetic-edges"};
+        for (int k = 0; k < generate; ++k) {
+            string path = tmpFile + "." + to_string(k) + ".raw";
+            vector<unsigned char> img = syntheticImage(width, height, channels, k);
+            if (!writeFile(path, img.data(), img.size())) {
+                cerr << "Cannot write " << path << endl;
+                return 1;
+            }
+            corpus.push_back({kinds[k], path, width, height});
+            scratch.push_back(path);
+        }
+    }
+
+    ostringstream json;
+    json << fixed << setprecision(3);
+    json << "{\n  \"config\": {\"width\": " << width << ", \"height\": " << height
+         << ", \"gray\": " << (grayscale ? "true" : "false")
+         << ", \"sampling\": \"" << (grayscale ? "gray" : sampling == YUV444 ? "444" : sampling == YUV422 ? "422" : "420") << "\""
+         << ", \"runs\": " << runs
+         << ", \"optimize\": " << (optimize ? "true" : "false")
+         << ", \"entropy\": \"" << (coder == RANS ? "rans" : "huffman") << "\""
+         << ", \"restart\": " << restart << ", \"threads\": " << threads
+         << ", \"simd\": " << (simd ? "true" : "false")
+         << ", \"fixed_point\": " << (fixedPointMode() ? "true" : "false") << "},\n";
+    json << "  \"results\": [";
+
+    Encoder encoder;
+    encoder.optimize = optimize;
+    encoder.coder = coder;
+    encoder.restart = restart;
+    encoder.threads = threads;
+    Decoder decoder;
+    decoder.threads = threads;
+    vector<unsigned char> coded;
+    auto fail = [&] {
+        for (const string& f : scratch)
+            remove(f.c_str());
+        return 1;
+    };
+
+    bool firstResult = true;
+    for (const BenchImage& img : corpus) {
+        vector<unsigned char> original(rawSize);
+        if (!readRawImage(img.path, original))
+            return fail();
+
+        for (int q : qualities) {
+            encoder.quality = q;
+            StageTimes enc, dec;
+            size_t fileSize = 0;
+            vector<unsigned char> decoded;
+            for (int r = 0; r < runs; ++r) {
+                StageTimes e, d;
+                if (!encodeRun(encoder, img, sampling, scratch[0], coded, fileSize, e) ||
+                    !decodeRun(decoder, scratch[0], scratch[1], decoded, d)) {
+                    cerr << "Benchmark failed on " << img.name << " at QF " << q << ".\n";
+                    return fail();
+                }
+                e.total = e.io + e.color + e.dct + e.entropy;
+                d.total = d.io + d.color + d.dct + d.entropy;
+                keepBest(enc, e, r == 0);
+                keepBest(dec, d, r == 0);
+            }
+            cerr << img.name << " QF " << q << ": " << fileSize << " bytes\n";
+
+            QualityMetrics quality = imageMetrics(original.data(), decoded.data(), width, height, channels, true, 0);
+            double megabytes = rawSize / 1e6;
+            json << (firstResult ? "\n" : ",\n") << "    {\"image\": " << jsonString(img.name)
+                 << ", \"qf\": " << q << ", \"bytes\": " << fileSize
+                 << ", \"bpp\": " << fileSize * 8.0 / (double(width) * height)
+                 << ", \"psnr\": " << quality.psnrAll << ", \"ssim\": " << quality.ssimAll
+                 << ", \"ms_ssim\": " << quality.msssimAll << ",\n";
+            jsonStages(json, "encode", enc, megabytes);
+            json << ",\n";
+            jsonStages(json, "decode", dec, megabytes);
+            json << "}";
+            firstResult = false;
+        }
+    }
+    json << "\n  ]\n}\n";
+
+    for (const string& f : scratch)
+        remove(f.c_str());
+
+    if (outputFile.empty()) {
+        cout << json.str();
+    } else {
+        ofstream os(outputFile);
+        os << json.str();
+        if (!os) {
+            cerr << "Cannot write " << outputFile << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
\ No newline at end of file
@@ -1,61 +1,226 @@
 #include "src/myimage.h"
 
-int main(int argc, char* argv[]) {
-    string inputFile, outputFile;
+// Decoder settings shared by every file of a run
+struct DecodeOptions {
     int QF = 50;              // Default Quality Factor
     bool grayscale = false;   // Whether to use grayscale mode
+    int threads = 0;          // Worker threads for sliced files (0: all cores)
+    bool stream = false;      // Decode strip by strip with bounded memory
+    int scale = 1;            // Output scaled down by 1, 2, 4 or 8
+    int region[4] = {};       // x, y, width, height of the region to decode (width 0: whole image)
+    bool jfif = false;        // Re-wrap the coefficients as a baseline JFIF file instead of decoding
+};
+
+// Decode one file with the working buffers of `work` (batch mode keeps one
+// per worker, reused from file to file). `rawBytes` is set to the size of
+// the saved image.
+static bool decodeFile(const string& inputFile, const string& outputFile, const DecodeOptions& opt,
+                       BatchContext& work, uint64_t& rawBytes) {
+    int QF = opt.QF;
+    bool grayscale = opt.grayscale;
+    Sampling sampling = grayscale ? GRAY : YUV420;
+    const int threads = opt.threads;
+    const bool stream = opt.stream;
+    const int scale = opt.scale;
+    const int* region = opt.region;
+    const bool jfif = opt.jfif;
+
+    // Streaming mode decodes and writes one restart slice at a time
+    if (stream && region[2] == 0) {
+        if (!decodeStream(inputFile, outputFile, scale, threads))
+            return false;
+        ifstream fin(inputFile, ios::binary);
+        ImageHeader header;
+        if (readHeader(fin, header) > 0)
+            rawBytes = uint64_t((header.width + scale - 1) / scale) * ((header.height + scale - 1) / scale) *
+                       (header.gray() ? 1 : 3);
+        return true;
+    }
+
+    // Map the encoded file; the entropy decoder reads it in place
+    MappedFile input;
+    if (!input.open(inputFile))
+        return false;
+
+    // Image size, mode and quality come from the file header; headerless
+    // legacy streams are 512x512 and rely on the -qf / -c options
+    ImageHeader header;
+    header.sampling = sampling;
+    header.quality = QF;
+    int offset = readHeader(input.data(), input.size(), header);
+    if (offset < 0)
+        return false;
+    const unsigned char* data = input.data() + offset;   // Bitstream
+    const size_t dataSize = input.size() - offset;
+
+    sampling = header.sampling;
+    grayscale = sampling == GRAY;
+
+    // Region decoding: only the blocks under the rectangle, found with the block index
+    if (region[2] > 0) {
+        if (scale != 1) {
+            cerr << "-region cannot be combined with -scale.\n";
+            return false;
+        }
+        vector<unsigned char> pixels = decodeRegion(data, dataSize, header,
+                                                    region[0], region[1], region[2], region[3]);
+        if (pixels.empty())
+            return false;
+        saveRawImage(outputFile, pixels.data(), static_cast<int>(pixels.size()));
+        rawBytes = pixels.size();
+        return true;
+    }
+    QF = qualityScale(header.quality); // Convert quality factor to quantization scale
+
+    const int width = header.width;
+    const int height = header.height;
+    const int pwidth = offset ? paddedSize(width, grayscale) : width;
+    const int pheight = offset ? paddedSize(height, grayscale) : height;
+    // Scaled decodes reconstruct a width / scale x height / scale frame
+    // (rounded up) directly from the low frequencies of each block
+    const int outWidth = (width + scale - 1) / scale;
+    const int outHeight = (height + scale - 1) / scale;
+    const size_t framesize = size_t(outWidth) * outHeight; // Grayscale image size in bytes
+    const int swidth = pwidth / scale;          // Size of the reconstructed padded frame
+    const int sheight = pheight / scale;
+    const int mcuRows = pheight / (grayscale ? 8 : 16);
+
+    EntropyTables tables = headerTables(header);
+    SparseCoefs& decoded = work.coef;
+    fitCoefs(decoded, pheight, pwidth, sampling);
+    vector<unsigned char>& image = work.frame;   // Reconstructed gray or YUV frame
+    if (!jfif)
+        image.resize(frameSamples(sheight, swidth, sampling));
+
+    if (header.restart == 0) {
+        // Decode the bitstream into a coefficient array (DC + AC)
+        if (!ACDCdecode(data, dataSize, decoded, pheight, sampling, tables))
+            return false;
+
+        // Perform inverse quantization and inverse DCT to reconstruct the image
+        if (!jfif)
+            iquantDct2Rows(decoded, image, QF, pheight, pwidth, sampling, 0, mcuRows, scale);
+    } else {
+        // Decode and reconstruct the independent restart slices in parallel
+        const int nslices = static_cast<int>(header.sliceOffsets.size());
+        if (header.sliceOffsets.back() > dataSize) {
+            cerr << "Slice table points past the end of the file.\n";
+            return false;
+        }
+        atomic<bool> ok(true);
+
+        ThreadPool pool(threads);
+        pool.parallelFor(nslices, [&](int s) {
+            int mcu0 = s * header.restart, mcu1 = min(mcuRows, mcu0 + header.restart);
+            size_t begin = header.sliceOffsets[s];
+            size_t end = (s + 1 < nslices) ? header.sliceOffsets[s + 1] : dataSize;
+            if (!ACDCdecodeSlice(data + begin, end - begin, decoded,
+                                 pheight, pwidth, sampling, mcu0, mcu1, tables))
+                ok = false;
+            if (!jfif)
+                iquantDct2Rows(decoded, image, QF, pheight, pwidth, sampling, mcu0, mcu1, scale);
+        });
+        if (!ok) {
+            cerr << "Some slices could not be decoded.\n";
+            return false;
+        }
+    }
+
+    // JFIF re-wrap: the coefficients go into a baseline JPEG file as they
+    // are, with optimized Huffman tables if the file had its own tables
+    if (jfif) {
+        vector<unsigned char> jpeg;
+        if (!writeJfif(decoded, header, header.customTables || header.coder == RANS, jpeg))
+            return false;
+        MappedOutput output;
+        if (!output.create(outputFile, jpeg.size()))
+            return false;
+        memcpy(output.data(), jpeg.data(), jpeg.size());
+        if (!output.close())
+            return false;
+        cout << "Saved JFIF image to: " << outputFile << endl;
+        rawBytes = uint64_t(width) * height * (grayscale ? 1 : 3);
+        return true;
+    }
+
+    // Save the reconstructed image, dropping the MCU padding: the pixels are
+    // written straight into the mapped output file
+    MappedOutput output;
+    if (!output.create(outputFile, framesize * (grayscale ? 1 : 3)))
+        return false;
+    if (grayscale) {
+        for (int y = 0; y < outHeight; ++y)
+            memcpy(output.data() + size_t(y) * outWidth, &image[size_t(y) * swidth], outWidth);
+    } else {
+        YUV2RGB(image.data(), swidth, sheight, sampling, output.data(), outWidth, outHeight); // Convert YUV to RGB
+    }
+    if (!output.close())
+        return false;
+    cout << "Saved raw image to: " << outputFile << endl;
+    rawBytes = framesize * (grayscale ? 1 : 3);
+
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    string inputFile, outputFile;
+    string batchFile;         // Manifest of input/output pairs (-batch)
+    DecodeOptions opt;
 
     // Parse command line arguments
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "-o") == 0) {
             outputFile = argv[++i];  // Get output file name
         } else if (strcmp(argv[i], "-qf") == 0) {
-            QF = atoi(argv[++i]);    // Get quality factor
+            opt.QF = atoi(argv[++i]); // Get quality factor
         } else if (strcmp(argv[i], "-c") == 0) {
-            if (strcmp(argv[++i], "gray") == 0) grayscale = true; // Set grayscale flag
+            if (strcmp(argv[++i], "gray") == 0) opt.grayscale = true; // Set grayscale flag
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            opt.threads = atoi(argv[++i]);  // Number of worker threads
+        } else if (strcmp(argv[i], "-stream") == 0) {
+            opt.stream = true;           // Streaming mode
+        } else if (strcmp(argv[i], "-scale") == 0) {
+            opt.scale = atoi(argv[++i]); // Thumbnail scale factor
+        } else if (strcmp(argv[i], "-region") == 0) {
+            sscanf(argv[++i], "%d,%d,%d,%d", &opt.region[0], &opt.region[1], &opt.region[2], &opt.region[3]);
+        } else if (strcmp(argv[i], "-jfif") == 0) {
+            opt.jfif = true;             // Baseline JFIF output
+        } else if (strcmp(argv[i], "-batch") == 0) {
+            batchFile = argv[++i];       // Manifest of files to decode
+        } else if (strcmp(argv[i], "-nosimd") == 0) {
+            setSimd(false);          // Force the scalar block kernels
+        } else if (strcmp(argv[i], "-fixed") == 0) {
+            setFixedPoint(true);     // Integer-only color conversion and DCT
         } else if (argv[i][0] != '-') {
             inputFile = argv[i];     // First non-flag argument is input file
         }
     }
 
-    // Convert quality factor to quantization scale
-    if (QF < 50)
-        QF = 5000 / QF;
-    else
-        QF = 200 - 2 * QF;
-
-    const int width = 512;    // Image width
-    const int height = 512;   // Image height
-    const int framesize = width * height; // Grayscale image size in bytes
-
-    // Open the input file
-    ifstream fin(inputFile, ios::binary);
-    if (!fin) {
-        cerr << "Failed to open input file.\n";
+    if (opt.scale != 1 && opt.scale != 2 && opt.scale != 4 && opt.scale != 8) {
+        cerr << "Scale must be 1, 2, 4 or 8.\n";
         return 1;
     }
-
-    // Read the encoded bitstream from the file
-    vector<unsigned char> encodedData((istreambuf_iterator<char>(fin)), {});
-    string bitstream = "";
-    for (unsigned char byte : encodedData) {
-        bitset<8> bits(byte);
-        bitstream += bits.to_string();  // Convert each byte to an 8-bit binary string
+    if (opt.jfif && (opt.stream || opt.scale != 1 || opt.region[2] > 0)) {
+        cerr << "-jfif re-wraps the whole image: it cannot be combined with -stream, -scale or -region.\n";
+        return 1;
     }
 
-    // Decode the bitstream into a coefficient array (DC + AC)
-    vector<int> decoded = ACDCdecode(bitstream, height, width, grayscale);
-
-    // Perform inverse quantization and inverse DCT to reconstruct the image
-    vector<unsigned char> image = iquantDct2(decoded, QF, height, width, grayscale);
-
-    // Save the reconstructed image
-    if (grayscale)
-        saveRawImage(outputFile, &image[0], framesize); // Save grayscale image
-    else {
-        vector<unsigned char> imageRGB = YUV2RGB(image, width, height); // Convert YUV to RGB
-        saveRawImage(outputFile, &imageRGB[0], framesize * 3); // Save color image
+    // Batch mode: the files of the manifest are decoded in parallel, one per
+    // worker thread, with the other options applied to each of them
+    if (!batchFile.empty()) {
+        vector<BatchJob> jobs;
+        if (!readManifest(batchFile, jobs))
+            return 1;
+        const int threads = opt.threads;
+        opt.threads = 1;
+        bool ok = runBatch(jobs, threads, [&](const BatchJob& job, BatchContext& ctx) -> uint64_t {
+            uint64_t rawBytes = 0;
+            return decodeFile(job.input, job.output, opt, ctx, rawBytes) ? rawBytes : 0;
+        });
+        return ok ? 0 : 1;
     }
 
-    return 0;
+    BatchContext work;
+    uint64_t rawBytes = 0;
+    return decodeFile(inputFile, outputFile, opt, work, rawBytes) ? 0 : 1;
 }
\ No newline at end of file
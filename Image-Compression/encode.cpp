@@ -1,56 +1,257 @@
 #include "src/myimage.h"
 
+// Encoder settings shared by every image of a run
+struct EncodeOptions {
+    int QF = 50;               // Default Quality Factor
+    Sampling sampling = YUV420; // Color mode: gray, or the chroma sampling
+    int restart = 0;           // MCU rows per restart slice (0: no slices)
+    int threads = 0;           // Worker threads for sliced encoding (0: all cores)
+    bool stream = false;       // Encode strip by strip with bounded memory
+    bool optimize = false;     // Two-pass encode with optimized Huffman tables
+    EntropyCoder coder = HUFFMAN; // Huffman or rANS coding of the bitstream
+    int index = 0;             // Blocks between block index entries (0: no index)
+    size_t targetBytes = 0;    // Pick the QF for this file size (0: use -qf)
+    vector<int> ladder;        // Several QFs (-qf A,B,C): one output file per QF
+    bool jfif = false;         // Write a baseline JFIF file instead of this codec's format
+};
+
+// Encode one width x height raw image with the working buffers of `work`
+// (batch mode keeps one per worker, reused from file to file)
+static bool encodeFile(const string& inputFile, const string& outputFile, int width, int height,
+                       const EncodeOptions& opt, BatchContext& work) {
+    int QF = opt.QF;
+    const Sampling sampling = opt.sampling;
+    const bool grayscale = sampling == GRAY;
+    const int restart = opt.restart;
+    const int threads = opt.threads;
+    const bool stream = opt.stream;
+    const bool optimize = opt.optimize || opt.coder == RANS;   // rANS always needs the statistics pass
+    const int index = opt.index;
+    const size_t targetBytes = opt.targetBytes;
+    const vector<int>& ladder = opt.ladder;
+
+    if (!validImageSize(width, height)) {
+        cerr << "Invalid image size (at most 65535 pixels a side and 2^29 pixels).\n";
+        return false;
+    }
+    const int mcuRows = paddedSize(height, grayscale) / (grayscale ? 8 : 16);
+    if (restart > mcuRows) {
+        cerr << "Restart interval larger than the " << mcuRows << " MCU rows of the image.\n";
+        return false;
+    }
+    if (index > paddedSize(width, grayscale) / 8) {
+        cerr << "Index interval larger than the " << paddedSize(width, grayscale) / 8 << " blocks of an image row.\n";
+        return false;
+    }
+
+    ImageHeader header;
+    header.width = width;
+    header.height = height;
+    header.sampling = sampling;
+    header.quality = clamp(QF, 1, 100);
+    header.coder = opt.coder;
+    header.index = blockIndex(index, paddedSize(height, grayscale), paddedSize(width, grayscale), sampling);
+
+    // Streaming mode reads, transforms and writes one restart slice at a time
+    if (stream) {
+        if (targetBytes > 0) {
+            cerr << "-target-bytes needs the whole image and cannot be combined with -stream.\n";
+            return false;
+        }
+        if (!encodeStream(inputFile, outputFile, header, max(1, restart), optimize, threads))
+            return false;
+        cout << "Compressed bitstream saved to " << outputFile << endl;
+        return true;
+    }
+
+    // Convert Quality Factor to quantization scale
+    QF = qualityScale(QF);
+
+    // Partial MCUs at the right and bottom edges are padded by edge replication
+    const int pwidth = paddedSize(width, grayscale);
+    const int pheight = paddedSize(height, grayscale);
+    const int channels = grayscale ? 1 : 3;
+
+    // Map the raw image: its pixels are read where they are, not copied
+    MappedFile input;
+    if (!input.open(inputFile))
+        return false;
+    if (input.size() < size_t(width) * height * channels) {
+        cerr << "Error reading file or file too short." << endl;
+        return false;
+    }
+    const unsigned char* pixels = input.data();
+    if (pwidth != width || pheight != height) {
+        work.padded.resize(size_t(pwidth) * pheight * channels);
+        padFrame(pixels, width, height, channels, pwidth, pheight, work.padded.data());
+        pixels = work.padded.data();
+    }
+
+    // Padded gray or YUV frame: the gray pixels themselves, or their conversion to YUV
+    if (!grayscale) {
+        work.frame.resize(frameSamples(pheight, pwidth, sampling));
+        RGB2YUV(pixels, pwidth, pheight, sampling, work.frame.data());  // Convert RGB to YUV
+    }
+    const unsigned char* frame = grayscale ? pixels : work.frame.data();
+
+    // Quality ladder: transform once, then quantize and code every QF
+    if (!ladder.empty())
+        return encodeLadder(frame, header, ladder, outputFile, restart, optimize, threads);
+
+    // JFIF output: the quantized coefficients written as a baseline JPEG file
+    if (opt.jfif) {
+        SparseCoefs& coef = work.coef;
+        fitCoefs(coef, pheight, pwidth, sampling);
+        quantDct2Rows(frame, coef, QF, pheight, pwidth, sampling, 0, pheight / (grayscale ? 8 : 16));
+        vector<unsigned char> jpeg;
+        if (!writeJfif(coef, header, opt.optimize, jpeg))
+            return false;
+        ofstream fout(outputFile, ios::binary);
+        if (!fout.write(reinterpret_cast<const char*>(jpeg.data()), jpeg.size())) {
+            cerr << "Cannot write output file.\n";
+            return false;
+        }
+        cout << "JFIF image saved to " << outputFile << endl;
+        return true;
+    }
+
+    // Rate control: transform once, then find the best QF whose file fits
+    // by quantizing and sizing the cached coefficients at each trial QF
+    SparseCoefs& imageDCT = work.coef;
+    const bool quantized = targetBytes > 0;
+    if (quantized) {
+        DctCache cache = dctCache(frame, pheight, pwidth, sampling);
+        header.quality = targetQuality(cache, header, restart, optimize, targetBytes, imageDCT);
+        if (header.quality == 0)
+            return false;
+        QF = qualityScale(header.quality);
+    }
+
+    // Perform DCT and quantization: restart slices are independent and
+    // transformed in parallel, then entropy-coded in parallel by the writer
+    ThreadPool pool(restart > 0 ? threads : 1);
+    if (!quantized) {
+        const int nslices = sliceCount(pheight, grayscale, restart);
+        const int rows = restart > 0 ? restart : mcuRows;   // MCU rows per slice
+        fitCoefs(imageDCT, pheight, pwidth, sampling);
+        pool.parallelFor(nslices, [&](int s) {
+            quantDct2Rows(frame, imageDCT, QF, pheight, pwidth, sampling, s * rows, min(mcuRows, (s + 1) * rows));
+        });
+    }
+
+    // Write the file header, then encode the DCT coefficients into a bitstream (DC + AC encoding)
+    if (!writeCodedFile(outputFile, header, imageDCT, restart, optimize, pool, work.slices))
+        return false;
+
+    cout << "Compressed bitstream saved to " << outputFile << endl;
+
+    return true;
+}
+
 int main(int argc, char* argv[]) {
     string inputFile, outputFile;
-    int QF = 50;               // Default Quality Factor
-    bool grayscale = false;   // Flag for grayscale mode
+    string batchFile;          // Manifest of input/output pairs (-batch)
+    EncodeOptions opt;
+    int width = 512;           // Image width (default 512)
+    int height = 512;          // Image height (default 512)
 
     // Parse command line arguments
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "-o") == 0) {
             outputFile = argv[++i];  // Output file path
         } else if (strcmp(argv[i], "-qf") == 0) {
-            QF = atoi(argv[++i]);    // Read Quality Factor
+            // Read Quality Factor, or a comma-separated list of them; a
+            // repeated QF is dropped, its rungs would write the same file
+            opt.ladder.clear();
+            for (char* p = argv[++i]; *p; ) {
+                int q = clamp(int(strtol(p, &p, 10)), 1, 100);
+                if (find(opt.ladder.begin(), opt.ladder.end(), q) == opt.ladder.end())
+                    opt.ladder.push_back(q);
+                if (*p == ',') ++p;
+                else break;
+            }
+            opt.QF = opt.ladder.empty() ? opt.QF : opt.ladder[0];
+            if (opt.ladder.size() < 2) opt.ladder.clear();
         } else if (strcmp(argv[i], "-c") == 0) {
-            if (strcmp(argv[++i], "gray") == 0) grayscale = true; // Enable grayscale mode
+            const char* mode = argv[++i];   // Gray level, or the chroma sampling of a color image
+            if (strcmp(mode, "gray") == 0) opt.sampling = GRAY;
+            else if (strcmp(mode, "420") == 0) opt.sampling = YUV420;
+            else if (strcmp(mode, "422") == 0) opt.sampling = YUV422;
+            else if (strcmp(mode, "444") == 0) opt.sampling = YUV444;
+            else {
+                cerr << "Unknown color mode " << mode << " (gray, 420, 422 or 444).\n";
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-w") == 0) {
+            width = atoi(argv[++i]);     // Image width
+        } else if (strcmp(argv[i], "-h") == 0) {
+            height = atoi(argv[++i]);    // Image height
+        } else if (strcmp(argv[i], "-restart") == 0) {
+            opt.restart = max(0, atoi(argv[++i])); // Restart interval in MCU rows
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            opt.threads = atoi(argv[++i]);  // Number of worker threads
+        } else if (strcmp(argv[i], "-stream") == 0) {
+            opt.stream = true;           // Streaming mode
+        } else if (strcmp(argv[i], "-optimize") == 0) {
+            opt.optimize = true;         // Optimized Huffman tables
+        } else if (strcmp(argv[i], "-entropy") == 0) {
+            const char* coder = argv[++i];  // Entropy coder of the bitstream
+            if (strcmp(coder, "huffman") == 0) opt.coder = HUFFMAN;
+            else if (strcmp(coder, "rans") == 0) opt.coder = RANS;
+            else {
+                cerr << "Unknown entropy coder " << coder << " (huffman or rans).\n";
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-target-bytes") == 0) {
+            opt.targetBytes = strtoull(argv[++i], nullptr, 10); // Target file size
+        } else if (strcmp(argv[i], "-index") == 0) {
+            opt.index = max(0, atoi(argv[++i])); // Block index for region decoding
+        } else if (strcmp(argv[i], "-jfif") == 0) {
+            opt.jfif = true;             // Baseline JFIF output
+        } else if (strcmp(argv[i], "-batch") == 0) {
+            batchFile = argv[++i];       // Manifest of files to encode
+        } else if (strcmp(argv[i], "-nosimd") == 0) {
+            setSimd(false);          // Force the scalar block kernels
+        } else if (strcmp(argv[i], "-fixed") == 0) {
+            setFixedPoint(true);     // Integer-only color conversion and DCT
         } else if (argv[i][0] != '-') {
             inputFile = argv[i];     // The first non-option argument is the input file path
         }
     }
 
-    // Convert Quality Factor to quantization scale (JPEG standard approximation)
-    if (QF < 50) 
-        QF = 5000 / QF;
-    else      
-        QF = 200 - 2 * QF;
-
-    const int width = 512;     // Fixed image width
-    const int height = 512;    // Fixed image height
-    const int framesize = width * height;
-
-    vector<int> imageDCT;      // Vector to hold quantized DCT coefficients
+    if (!opt.ladder.empty() && (opt.stream || opt.targetBytes > 0)) {
+        cerr << "A list of QFs cannot be combined with -stream or -target-bytes.\n";
+        return 1;
+    }
+    if (opt.index > 0 && opt.coder == RANS) {
+        cerr << "-index needs Huffman coding: a rANS stream cannot be entered at a block.\n";
+        return 1;
+    }
+    if (opt.jfif && (opt.stream || opt.restart > 0 || opt.index > 0 || opt.coder == RANS ||
+                     opt.targetBytes > 0 || !opt.ladder.empty())) {
+        cerr << "-jfif writes a single-scan baseline JPEG: it cannot be combined with -stream, -restart, "
+                "-index, -entropy rans, -target-bytes or a list of QFs.\n";
+        return 1;
+    }
 
-    if (grayscale) {
-        // Grayscale mode
-        vector<unsigned char> imageGRAY(framesize);  // Allocate grayscale image buffer
-        if (!readRawImage(inputFile, imageGRAY))     // Read raw grayscale image
+    // Batch mode: the images of the manifest are encoded in parallel, one
+    // per worker thread, with the other options applied to each of them
+    if (!batchFile.empty()) {
+        vector<BatchJob> jobs;
+        if (!readManifest(batchFile, jobs))
             return 1;
-        imageDCT = quantDct2(imageGRAY, QF, height, width, grayscale); // Perform DCT and quantization
-    } else {
-        // Color mode
-        vector<unsigned char> imageRGB(framesize * 3);  // Allocate RGB image buffer
-        if (!readRawImage(inputFile, imageRGB))         // Read raw RGB image
-            return 1;
-        vector<unsigned char> imageYUV = RGB2YUV(imageRGB, width, height); // Convert RGB to YUV
-        imageDCT = quantDct2(imageYUV, QF, height, width, grayscale);      // Perform DCT and quantization on YUV
+        const int threads = opt.threads;
+        opt.threads = 1;
+        bool ok = runBatch(jobs, threads, [&](const BatchJob& job, BatchContext& ctx) -> uint64_t {
+            int w = job.width > 0 ? job.width : width;
+            int h = job.height > 0 ? job.height : height;
+            if (!encodeFile(job.input, job.output, w, h, opt, ctx))
+                return 0;
+            return uint64_t(w) * h * (opt.sampling == GRAY ? 1 : 3);
+        });
+        return ok ? 0 : 1;
     }
 
-    // Encode the DCT coefficients into a bitstream (DC + AC encoding)
-    string bitstream = DCAC(imageDCT, height, width, grayscale);
-
-    // Save the bitstream to a file (e.g., a custom bitmap or binary format)
-    if (saveBitmap(bitstream, outputFile))
-        cout << "Compressed bitstream saved to " << outputFile << endl;
-
-    return 0;
-}
+    BatchContext work;
+    return encodeFile(inputFile, outputFile, width, height, opt, work) ? 0 : 1;
+}
\ No newline at end of file
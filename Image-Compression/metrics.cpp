@@ -0,0 +1,101 @@
+#include <iomanip>
+#include <sstream>
+#include "src/myimage.h"
+
+// Quality metrics of a decoded raw image against its original, as JSON:
+// MSE and PSNR per channel and overall, and SSIM and MS-SSIM per channel
+// (see src/quality.cpp). Both files are compared where they are mapped.
+
+// Write the per-channel values of a metric and the overall value `all`
+static void jsonMetric(ostream& os, const char* name, const double* values, double all, int channels, bool last) {
+    static const char* names[3] = {"r", "g", "b"};
+    os << "  \"" << name << "\": {";
+    if (channels == 3)
+        for (int c = 0; c < 3; ++c)
+            os << "\"" << names[c] << "\": " << values[c] << ", ";
+    os << "\"all\": " << all << "}" << (last ? "\n" : ",\n");
+}
+
+int main(int argc, char* argv[]){
+
+    string originFile, compressFile;
+    string outputFile;          // JSON report (default: standard output)
+    bool grayscale=false;
+    bool structural=true;       // SSIM and MS-SSIM
+    bool simd=true;
+    int width=512, height=512;
+    int threads=0;              // 0: all cores
+
+    // Parse command line arguments
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-a") == 0) {
+            originFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "-b") == 0) {
+            compressFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "-c") == 0) {
+            if(strcmp(argv[++i], "gray") == 0) grayscale=true;
+        }
+        else if (strcmp(argv[i], "-w") == 0) {
+            width = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-h") == 0) {
+            height = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-threads") == 0) {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0) {
+            outputFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "-nossim") == 0) {
+            structural = false;
+        }
+        else if (strcmp(argv[i], "-nosimd") == 0) {
+            simd = false;
+        }
+    }
+
+    if (width <= 0 || height <= 0) {
+        cerr << "Invalid image size.\n";
+        return 1;
+    }
+    setSimd(simd);
+
+    const int channels = grayscale ? 1 : 3;
+    const size_t framesize = size_t(width) * height * channels;
+
+    // Both images are compared where they are mapped, without reading them into buffers
+    MappedFile originImage, compressImage;
+    if (!originImage.open(originFile) || !compressImage.open(compressFile)) return 1;
+    if (originImage.size() < framesize || compressImage.size() < framesize) {
+        cerr << "Error reading file or file too short." << endl;
+        return 1;
+    }
+
+    QualityMetrics m = imageMetrics(originImage.data(), compressImage.data(), width, height, channels, structural, threads);
+
+    ostringstream json;
+    json << fixed << setprecision(6);
+    json << "{\n  \"width\": " << width << ", \"height\": " << height << ", \"channels\": " << channels << ",\n";
+    jsonMetric(json, "mse", m.mse, m.mseAll, channels, false);
+    jsonMetric(json, "psnr", m.psnr, m.psnrAll, channels, !structural);
+    if (structural) {
+        jsonMetric(json, "ssim", m.ssim, m.ssimAll, channels, false);
+        jsonMetric(json, "ms_ssim", m.msssim, m.msssimAll, channels, true);
+    }
+    json << "}\n";
+
+    if (outputFile.empty()) {
+        cout << json.str();
+    } else {
+        ofstream os(outputFile);
+        os << json.str();
+        if (!os) {
+            cerr << "Cannot write " << outputFile << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
\ No newline at end of file
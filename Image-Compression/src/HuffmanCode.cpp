@@ -1,296 +1,577 @@
 #include "myimage.h"
 #include "HuffmanTable.h"
 
-//Encode signed integers to binary (JPEG style)
-string bincode(int val){
-    string bin = "";
-    if(val>=0){
-        while (val > 0) {
-            int bit = val%2;
-            bin.push_back('0' + bit);
-            val /= 2;
+// Packed codes of a standard table
+template <int N>
+struct PackedTable {
+    HuffCode codes[N] = {};
+};
+
+// Convert a table of '0'/'1' code strings into packed codes, at compile time
+template <int N>
+static constexpr PackedTable<N> packTable(const char* const (&table)[N]) {
+    PackedTable<N> out;
+    for (int i = 0; i < N; ++i) {
+        for (const char* c = table[i]; c && *c; ++c) {
+            out.codes[i].code = static_cast<uint16_t>((out.codes[i].code << 1) | (*c == '1'));
+            out.codes[i].len++;
         }
     }
-    else{
-        val = abs(val);
-        while (val > 0) {
-            int bit = (val+1)%2;
-            bin.push_back('0' + bit);
-            val /= 2;
+    return out;
+}
+
+static constexpr PackedTable<DC_SYMBOLS> stdLuDC = packTable(luminanceDC);
+static constexpr PackedTable<DC_SYMBOLS> stdChDC = packTable(chrominanceDC);
+static constexpr PackedTable<AC_SYMBOLS> stdLuAC = packTable(luminanceAC);
+static constexpr PackedTable<AC_SYMBOLS> stdChAC = packTable(chrominanceAC);
+
+static_assert(stdLuDC.codes[0].len == 2 && stdLuAC.codes[0].code == 0xA && stdLuAC.codes[0].len == 4,
+              "standard tables are packed at compile time");
+
+HuffDecoder::HuffDecoder(const HuffCode* codes, int size) : HuffDecoder() {
+    for (int s = 0; s < size; ++s) {
+        int len = codes[s].len;
+        if (len == 0) continue;  // Unused symbol
+        uint32_t code = codes[s].code;
+        if (len <= LOOKUP) {
+            // Fill every table slot that starts with this code
+            int shift = LOOKUP - len;
+            for (uint32_t k = 0; k < (1u << shift); ++k)
+                fast[(code << shift) | k] = {static_cast<int16_t>(s), static_cast<uint8_t>(len)};
+        } else {
+            Entry& e = fast[code >> (len - LOOKUP)];
+            if (e.symbol < 0) {
+                e.symbol = static_cast<int16_t>(sub.size() >> SUBBITS);
+                sub.resize(sub.size() + (1 << SUBBITS), Entry{-1, 0});
+            }
+            Entry* table = &sub[e.symbol << SUBBITS];
+            int shift = 16 - len;
+            uint32_t low = code & ((1u << (len - LOOKUP)) - 1);
+            for (uint32_t k = 0; k < (1u << shift); ++k)
+                table[(low << shift) | k] = {static_cast<int16_t>(s), static_cast<uint8_t>(len)};
         }
     }
+}
 
-	reverse(bin.begin(), bin.end());
-    return bin;
+EntropyTables::EntropyTables() {
+    copy(begin(stdLuDC.codes), end(stdLuDC.codes), luDC);
+    copy(begin(stdChDC.codes), end(stdChDC.codes), chDC);
+    copy(begin(stdLuAC.codes), end(stdLuAC.codes), luAC);
+    copy(begin(stdChAC.codes), end(stdChAC.codes), chAC);
+    dLuDC = HuffDecoder(luDC, DC_SYMBOLS);
+    dChDC = HuffDecoder(chDC, DC_SYMBOLS);
+    dLuAC = HuffDecoder(luAC, AC_SYMBOLS);
+    dChAC = HuffDecoder(chAC, AC_SYMBOLS);
 }
-    
-string DCAC(vector<int> img, int height, int width, bool gray=false) {
-    string bitstream = "";
 
-    // Encode luminance blocks
-    for (int y = 0; y < height; y+=8) {
-        for (int x = 0; x < width; x+=8) {
-            int idx = y * width + x;
+EntropyTables::EntropyTables(const HuffmanSpec* specs) {
+    huffmanCodes(specs[0], luDC, DC_SYMBOLS);
+    huffmanCodes(specs[1], luAC, AC_SYMBOLS);
+    huffmanCodes(specs[2], chDC, DC_SYMBOLS);
+    huffmanCodes(specs[3], chAC, AC_SYMBOLS);
+    dLuDC = HuffDecoder(luDC, DC_SYMBOLS);
+    dChDC = HuffDecoder(chDC, DC_SYMBOLS);
+    dLuAC = HuffDecoder(luAC, AC_SYMBOLS);
+    dChAC = HuffDecoder(chAC, AC_SYMBOLS);
+}
 
-            // DC difference encoding (DPCM)
-            int DIFF = (idx == 0) ? img[idx]
-                     : (x == 0) ? img[idx] - img[idx - width * 8]
-                                : img[idx] - img[idx - 8];
-
-            bitstream += (DIFF == 0) ? luminanceDC[0]
-                                     : luminanceDC[(int)log2(abs(DIFF)) + 1];
-            bitstream += bincode(DIFF);
-
-            // AC run-length and Huffman encoding
-            int n0 = 0;
-            for (int i = 1; i < 64; ++i) {
-                idx = y * width + x + zigzagIndex[i][0] + zigzagIndex[i][1] * width;
-                if (img[idx] == 0) {
-                    n0++;
-                } else {
-                    while (n0 > 15) {
-                        bitstream += luminanceAC[15 * 11]; // ZRL
-                        n0 -= 15;
-                    }
-                    bitstream += luminanceAC[n0 * 11 + (int)log2(abs(img[idx])) + 1];
-                    bitstream += bincode(img[idx]);
-                    n0 = 0;
-                }
-            }
-            bitstream += luminanceAC[0]; // End-of-block
+const EntropyTables& defaultTables() {
+    static const EntropyTables tables;
+    return tables;
+}
+
+void SymbolStats::add(const SymbolStats& o) {
+    for (int i = 0; i < DC_SYMBOLS; ++i) {
+        luDC[i] += o.luDC[i];
+        chDC[i] += o.chDC[i];
+    }
+    for (int i = 0; i < AC_SYMBOLS; ++i) {
+        luAC[i] += o.luAC[i];
+        chAC[i] += o.chAC[i];
+        for (int b = 0; b < AC_BANDS; ++b) {
+            luBand[b][i] += o.luBand[b][i];
+            chBand[b][i] += o.chBand[b][i];
         }
     }
+}
 
-    // Chrominance (U, V)
-    if (!gray) {
-        int framesize = height * width;
-        for (int y = 0; y < height; y += 8) {
-            for (int x = 0; x < width / 2; x += 8) {
-                int idx = y * width/2 + x + framesize;
-
-                int DIFF = (idx == 0) ? img[idx]
-                         : (x == 0) ? img[idx] - img[idx - width * 4]
-                                    : img[idx] - img[idx - 8];
-
-                bitstream += (DIFF == 0) ? chrominanceDC[0]
-                                         : chrominanceDC[(int)log2(abs(DIFF)) + 1];
-                bitstream += bincode(DIFF);
-
-                int n0 = 0;
-                for (int i = 1; i < 64; ++i) {
-                    idx = y * width/2 + x + framesize + zigzagIndex[i][0] + zigzagIndex[i][1] * width/2;
-                    if (img[idx] == 0) {
-                        n0++;
-                    } else {
-                        while (n0 > 15) {
-                            bitstream += chrominanceAC[165]; // ZRL
-                            n0 -= 15;
-                        }
-                        bitstream += chrominanceAC[n0 * 11 + (int)log2(abs(img[idx])) + 1];
-                        bitstream += bincode(img[idx]);
-                        n0 = 0;
-                    }
-                }
-                bitstream += chrominanceAC[0]; // End-of-block
-            }
+// Generate the canonical codes of a table (JPEG Annex C). Symbols not in the
+// table get length 0. Returns false if the table is not a valid prefix code.
+bool huffmanCodes(const HuffmanSpec& spec, HuffCode* codes, int size) {
+    for (int i = 0; i < size; ++i) codes[i] = {0, 0};
+    uint32_t code = 0;
+    size_t k = 0;
+    for (int len = 1; len <= 16; ++len) {
+        for (int i = 0; i < spec.bits[len]; ++i, ++k, ++code) {
+            if (k >= spec.vals.size() || spec.vals[k] >= size || code >= (1u << len))
+                return false;
+            codes[spec.vals[k]] = {static_cast<uint16_t>(code), static_cast<uint8_t>(len)};
+        }
+        code <<= 1;
+    }
+    return k == spec.vals.size();
+}
+
+// Build an optimal length-limited (<= 16 bits) Huffman table for the symbol
+// frequencies `freq[0..size)` (JPEG Annex K.2). A reserved extra symbol keeps
+// the all-ones code unused.
+HuffmanSpec buildHuffmanSpec(const uint32_t* freq, int size) {
+    vector<uint64_t> f(size + 1, 0);
+    vector<int> codesize(size + 1, 0), others(size + 1, -1);
+    for (int i = 0; i < size; ++i) f[i] = freq[i];
+    f[size] = 1;
+
+    // Repeatedly merge the two least frequent trees
+    for (;;) {
+        int c1 = -1, c2 = -1;
+        for (int i = 0; i <= size; ++i)
+            if (f[i] && (c1 < 0 || f[i] <= f[c1])) c1 = i;
+        for (int i = 0; i <= size; ++i)
+            if (f[i] && i != c1 && (c2 < 0 || f[i] <= f[c2])) c2 = i;
+        if (c2 < 0) break;
+
+        f[c1] += f[c2];
+        f[c2] = 0;
+        for (++codesize[c1]; others[c1] >= 0; ++codesize[c1]) c1 = others[c1];
+        others[c1] = c2;
+        for (++codesize[c2]; others[c2] >= 0; ++codesize[c2]) c2 = others[c2];
+    }
+
+    int maxlen = max(size + 1, 16);
+    vector<int> bits(maxlen + 1, 0);
+    for (int i = 0; i <= size; ++i)
+        if (codesize[i]) bits[codesize[i]]++;
+
+    // Limit code lengths to 16 bits
+    for (int i = maxlen; i > 16; --i) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) --j;
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
         }
     }
+    // Drop the reserved symbol (one of the longest codes)
+    int i = 16;
+    while (bits[i] == 0) --i;
+    bits[i]--;
+
+    HuffmanSpec spec;
+    for (int len = 1; len <= 16; ++len) spec.bits[len] = static_cast<unsigned char>(bits[len]);
+    for (int len = 1; len <= maxlen; ++len)
+        for (int s = 0; s < size; ++s)
+            if (codesize[s] == len) spec.vals.push_back(static_cast<unsigned char>(s));
+    return spec;
+}
+
+// Store tables fitted to the symbol counts `st` in the header: optimized
+// Huffman tables, or the rANS frequencies of a rANS-coded file
+void optimizeTables(ImageHeader& hdr, const SymbolStats& st) {
+    if (hdr.coder == RANS) {
+        hdr.rans = buildRansSpec(st, hdr.gray());
+        return;
+    }
+    hdr.customTables = true;
+    hdr.huffman[0] = buildHuffmanSpec(st.luDC, DC_SYMBOLS);
+    hdr.huffman[1] = buildHuffmanSpec(st.luAC, AC_SYMBOLS);
+    hdr.huffman[2] = hdr.gray() ? HuffmanSpec() : buildHuffmanSpec(st.chDC, DC_SYMBOLS);
+    hdr.huffman[3] = hdr.gray() ? HuffmanSpec() : buildHuffmanSpec(st.chAC, AC_SYMBOLS);
+}
 
-    return bitstream;
+// Tables a file is coded with: its rANS model, its own Huffman tables, or the standard ones
+EntropyTables headerTables(const ImageHeader& hdr) {
+    if (hdr.coder == RANS)
+        return EntropyTables(hdr.rans);
+    return hdr.customTables ? EntropyTables(hdr.huffman) : defaultTables();
 }
 
+// Magnitude bits of a signed coefficient (JPEG style: negatives in one's
+// complement), without a branch: the sign mask adds 2^cat - 1 to negatives
+static inline uint32_t magnitude(int val, int cat) {
+    return static_cast<uint32_t>(val + ((val >> 31) & ((1 << cat) - 1)));
+}
 
-struct Node {
-    int symbol;
-    Node* left;
-    Node* right;
-    Node() : symbol(-1), left(nullptr), right(nullptr) {}
+// Symbol sinks for encodeRows(): one writes Huffman codes (and records the
+// block index, if any), one queues rANS symbols, one counts symbols. AC
+// symbols come with the zigzag band they are coded in (acBand).
+struct HuffmanSink {
+    const HuffCode* DC;
+    const HuffCode* AC;
+    BitWriter& bw;
+    BlockIndex* index;
+    inline void mark(int row, size_t bx, int pred) {
+        if (index && bx % index->interval == 0)
+            index->rows[row][bx / index->interval] = {bw.bitCount(), static_cast<int16_t>(pred)};
+    }
+    // The code and the magnitude bits go out in one put (at most 16 + 11 bits)
+    inline void dc(int cat, int val) {
+        bw.put((uint32_t(DC[cat].code) << cat) | magnitude(val, cat), DC[cat].len + cat);
+    }
+    inline void ac(int, int symbol, int cat, int val) {
+        bw.put((uint32_t(AC[symbol].code) << cat) | magnitude(val, cat), AC[symbol].len + cat);
+    }
 };
 
+struct RansSink {
+    RansEncoder& enc;
+    bool chroma;
+    inline void mark(int, size_t, int) {}
+    inline void dc(int cat, int val) { enc.put(dcContext(chroma), cat, cat, magnitude(val, cat)); }
+    inline void ac(int band, int symbol, int cat, int val) {
+        enc.put(acContext(chroma, band), symbol, cat, magnitude(val, cat));
+    }
+};
 
-// Insert a symbol and its binary code into the Huffman decoding tree
-void insertCode(Node* root, const string& code, int symbol) {
-    Node* node = root;
-    for (char c : code) {
-        if (c == '0') {
-            if (!node->left) node->left = new Node();
-            node = node->left;
-        } else {
-            if (!node->right) node->right = new Node();
-            node = node->right;
-        }
+struct CountSink {
+    uint32_t* DC;
+    uint32_t* AC;
+    uint32_t (*band)[AC_SYMBOLS];
+    inline void mark(int, size_t, int) {}
+    inline void dc(int cat, int) { DC[cat]++; }
+    inline void ac(int b, int symbol, int, int) {
+        AC[symbol]++;
+        band[b][symbol]++;
     }
-    node->symbol = symbol;  // Set the symbol at the leaf node
-}
+};
 
-Node* buildTree(const char** table, int size){
+// Adds up the number of bits the Huffman codes would take, without writing them
+struct SizeSink {
+    const HuffCode* DC;
+    const HuffCode* AC;
+    uint64_t& bits;
+    inline void mark(int, size_t, int) {}
+    inline void dc(int cat, int) { bits += DC[cat].len + cat; }
+    inline void ac(int, int symbol, int cat, int) { bits += AC[symbol].len + cat; }
+};
 
-    vector<pair<string, int>> symbols;  // Pair of (symbol, code length)
-    for (int i = 0; i < size; ++i) {
-        symbols.emplace_back(table[i], i);
+// Same for rANS, from the code length of each symbol in 1/256 bit
+struct RansSizeSink {
+    const RansModel& model;
+    bool chroma;
+    uint64_t& cost;
+    inline void mark(int, size_t, int) {}
+    inline void dc(int cat, int) { cost += model.ctx[dcContext(chroma)].cost[cat] + (cat << 8); }
+    inline void ac(int band, int symbol, int cat, int) {
+        cost += model.ctx[acContext(chroma, band)].cost[symbol] + (cat << 8);
     }
+};
 
-    sort(symbols.begin(), symbols.end(), [](auto& a, auto& b) {
-        if (a.second == b.second) return a.first < b.first;
-        return a.second < b.second;
-    });
+// Encode block rows [by0, by1) of one coefficient plane (DC DPCM + AC run-length).
+// The first block is predicted from `pred0`, the first block of every other
+// row from the block above it, and all other blocks from their left neighbour.
+template <class Sink>
+static void encodeRows(const SparseCoefs& img, bool chroma, int by0, int by1, int pred0, Sink out) {
+    for (int by = by0; by < by1; ++by) {
+        const CoefRow& row = img.row(chroma, by);
+        const RunLevel* ac = row.ac.data();
+        const int rowId = (chroma ? img.lumaRows : 0) + by;
+        for (size_t bx = 0; bx < row.dc.size(); ++bx) {
+            // DC difference encoding (DPCM)
+            int pred = (by == by0 && bx == 0) ? pred0
+                     : (bx == 0) ? img.row(chroma, by - 1).dc[0]
+                                 : row.dc[bx - 1];
+            out.mark(rowId, bx, pred);
+            int DIFF = row.dc[bx] - pred;
+
+            int cat = magnitudeCategory(DIFF);
+            out.dc(cat, DIFF);
+
+            // AC run-length and Huffman encoding of the nonzero coefficients;
+            // k is the zigzag position of the last one coded
+            int k = 0;
+            for (; ac->level != 0; ++ac) {
+                int n0 = ac->run;
+                while (n0 > 15) {
+                    out.ac(acBand(k), 15 * 11, 0, 0); // ZRL
+                    n0 -= 15;
+                }
+                cat = magnitudeCategory(ac->level);
+                out.ac(acBand(k), n0 * 11 + cat, cat, ac->level);
+                k += ac->run + 1;
+            }
+            ++ac;
+            out.ac(acBand(k), 0, 0, 0); // End-of-block
+        }
+    }
+}
 
-    // Step 3: Build Huffman decoding tree from the canonical codebook
-    Node* root = new Node();
-    for (auto& kv : symbols) {
-        insertCode(root, kv.first, kv.second);
+// The original stream format predicts the first chroma DC from a luminance
+// coefficient: the one at sample position (height - 4, 0) of the old raster
+// coefficient plane, i.e. row 4, column 0 of the first block of the last row
+static int legacyChromaPred(const SparseCoefs& img) {
+    const int k = static_cast<int>(find(zigzagPos, zigzagPos + 64, 4 * 8) - zigzagPos);
+    int pos = 0;
+    for (const RunLevel* ac = img.row(false, img.lumaRows - 1).ac.data(); ac->level != 0; ++ac) {
+        pos += ac->run + 1;
+        if (pos >= k)
+            return pos == k ? ac->level : 0;
     }
+    return 0;
+}
 
-    return root;
+template <class Sink>
+static void encodeFrame(const SparseCoefs& img, int height, Sampling s, Sink lu, Sink ch) {
+    // Encode luminance blocks
+    encodeRows(img, false, 0, height / 8, 0, lu);
+
+    // Chrominance (U, V) stacked in one plane; its first DC is predicted
+    // from the luminance plane, as the original stream format does
+    if (s != GRAY)
+        encodeRows(img, true, 0, 2 * chromaHeight(height, s) / 8, legacyChromaPred(img), ch);
 }
 
+// Encode one restart slice: MCU rows [mcu0, mcu1) of every component, each
+// starting with a fresh DC predictor
+template <class Sink>
+static void encodeSlice(const SparseCoefs& img, int height, int width, Sampling s, int mcu0, int mcu1,
+                        Sink lu, Sink ch) {
+    for (const PlaneRows& p : sliceRows(height, width, s, mcu0, mcu1))
+        encodeRows(img, p.chroma, p.row0, p.row1, 0, p.chroma ? ch : lu);
+}
 
-//Decode JPEG binary string to integer
-int bindecode(string bin){
-    int val=0;
+// Size in bits of the rANS stream of a bitstream whose symbols cost `cost`
+// (1/256 bit): the symbols, and the final states at its start
+static uint64_t ransBits(uint64_t cost) {
+    return (cost + 255) / 256 + 32 * RANS_STATES;
+}
 
-    if(bin[0]=='0'){
-        for(char c : bin){
-            val = val<<1;
-            if(c=='0') val++;
-        }
-        val = -val;
+// `index`, if given, must be sized by blockIndex(); its entries are filled in.
+// A rANS stream has no block index.
+void DCAC(const SparseCoefs& img, int height, Sampling s, const EntropyTables& t, BitWriter& bw,
+          BlockIndex* index) {
+    if (t.coder == RANS) {
+        RansEncoder enc(*t.rans);
+        encodeFrame(img, height, s, RansSink{enc, false}, RansSink{enc, true});
+        enc.finish(bw);
+        return;
     }
-    else{
-        for(char c : bin){
-            val = val<<1;
-            if(c=='1') val++;
-        }
+    encodeFrame(img, height, s, HuffmanSink{t.luDC, t.luAC, bw, index}, HuffmanSink{t.chDC, t.chAC, bw, index});
+}
+
+void DCAC(const SparseCoefs& img, int height, Sampling s, SymbolStats& st) {
+    encodeFrame(img, height, s, CountSink{st.luDC, st.luAC, st.luBand}, CountSink{st.chDC, st.chAC, st.chBand});
+}
+
+// The slice ends on a byte boundary. Index entries get bit offsets relative
+// to the start of the slice (see shiftIndex).
+void DCACslice(const SparseCoefs& img, int height, int width, Sampling s, int mcu0, int mcu1,
+               const EntropyTables& t, BitWriter& bw, BlockIndex* index) {
+    if (t.coder == RANS) {
+        RansEncoder enc(*t.rans);
+        encodeSlice(img, height, width, s, mcu0, mcu1, RansSink{enc, false}, RansSink{enc, true});
+        enc.finish(bw);
+    } else {
+        encodeSlice(img, height, width, s, mcu0, mcu1,
+                    HuffmanSink{t.luDC, t.luAC, bw, index}, HuffmanSink{t.chDC, t.chAC, bw, index});
     }
+    bw.flush();
+}
 
-    return val;
+void DCACslice(const SparseCoefs& img, int height, int width, Sampling s, int mcu0, int mcu1, SymbolStats& st) {
+    encodeSlice(img, height, width, s, mcu0, mcu1, CountSink{st.luDC, st.luAC, st.luBand},
+                CountSink{st.chDC, st.chAC, st.chBand});
 }
 
-vector<int> ACDCdecode(string bitstream, int height, int width, bool gray=false) {
-    int framesize = height * width;
-
-    // Build Huffman decoding trees for luminance and chrominance DC/AC
-    Node* luDC = buildTree(luminanceDC, 12);
-    Node* chDC = buildTree(chrominanceDC, 12);
-    Node* luAC = buildTree(luminanceAC, 176);
-    Node* chAC = buildTree(chrominanceAC, 176);
-
-    // Vector to store decoded DPCM coefficients (in zigzag order)
-    vector<int> decoded;
-    Node* node = luDC; // Start with luminance DC tree
-
-    int mod = 0; // 0: expecting DC symbol, 1: expecting AC symbol or zeros
-    int typ = 0; // 0: luminance, 1: chrominance
-    string num = ""; // Holds the binary number for DIFF or AC coefficient
-    int numlen = 0;  // Number of bits remaining to read for DIFF or AC value
-
-    // Main decoding loop over bitstream
-    for (char bit : bitstream) {
-
-        // If we are currently reading the actual value (after Huffman length code)
-        if (numlen > 0) {
-            num += bit;
-            numlen--;
-            if (numlen <= 0) {
-                decoded.push_back(bindecode(num)); // Convert binary string to int
-                num = "";
-            }
-            continue;
-        }
 
-        // Huffman tree traversal
-        node = (bit == '0') ? node->left : node->right;
+// Size in bits of the DCAC bitstream, before padding to a byte
+uint64_t DCACbits(const SparseCoefs& img, int height, Sampling s, const EntropyTables& t) {
+    uint64_t bits = 0;
+    if (t.coder == RANS) {
+        encodeFrame(img, height, s, RansSizeSink{*t.rans, false, bits}, RansSizeSink{*t.rans, true, bits});
+        return ransBits(bits);
+    }
+    encodeFrame(img, height, s, SizeSink{t.luDC, t.luAC, bits}, SizeSink{t.chDC, t.chAC, bits});
+    return bits;
+}
 
-        // Safety check for invalid traversal
-        if (!node) {
-            cerr << "Decoding error: invalid traversal in Huffman tree.\n";
-            break;
-        }
+uint64_t DCACsliceBits(const SparseCoefs& img, int height, int width, Sampling s, int mcu0, int mcu1,
+                       const EntropyTables& t) {
+    uint64_t bits = 0;
+    if (t.coder == RANS) {
+        encodeSlice(img, height, width, s, mcu0, mcu1, RansSizeSink{*t.rans, false, bits},
+                    RansSizeSink{*t.rans, true, bits});
+        return ransBits(bits);
+    }
+    encodeSlice(img, height, width, s, mcu0, mcu1, SizeSink{t.luDC, t.luAC, bits}, SizeSink{t.chDC, t.chAC, bits});
+    return bits;
+}
 
-        // Leaf node found — process symbol
-        if (node->symbol != -1) {
-            if (mod == 0) { // Handling DC component
-                numlen = node->symbol;
-                if (numlen == 0) decoded.push_back(0); // Zero difference
-                mod = 1; // Next we will read AC components
-                node = (typ == 0) ? luAC : chAC; // Switch to AC tree
-            } else if (mod == 1) { // Handling AC component
-                int idx = node->symbol;
-
-                if (idx == 0) { // End of Block (EOB)
-                    while (decoded.size() % 64 != 0) decoded.push_back(0); // Fill rest of block with zeros
-                    mod = 0; // Next block will begin with DC again
-                    if (decoded.size() >= framesize) typ = 1; // Switch to chrominance after luminance
-                    node = (typ == 0) ? luDC : chDC; // Switch to correct DC tree
-                    continue;
-                } else {
-                    int n0 = idx / 11; // Run of zeros
-                    while (n0-- > 0) decoded.push_back(0);
-                    numlen = idx % 11; // Bits to read for the non-zero value
-                    node = (typ == 0) ? luAC : chAC; // Remain in AC tree
-                }
-            }
+// Restore the signed value of `cat` magnitude bits
+static inline int extend(int val, int cat) {
+    return (cat > 0 && val < (1 << (cat - 1))) ? val - (1 << cat) + 1 : val;
+}
+
+// Symbol sources for decodeRows(), the mirror of the sinks: Huffman codes
+// and magnitude bits from a bit reader, or rANS symbols
+struct HuffmanSource {
+    BitReader& br;
+    const HuffDecoder& DC;
+    const HuffDecoder& AC;
+    inline int dc() { return DC.decode(br); }
+    inline int ac(int) { return AC.decode(br); }
+    inline int value(int cat) { return extend(br.get(cat), cat); }
+};
+
+struct RansSource {
+    RansDecoder& rd;
+    const RansModel& model;
+    bool chroma;
+    inline int dc() { return rd.get(model.ctx[dcContext(chroma)]); }
+    inline int ac(int band) { return rd.get(model.ctx[acContext(chroma, band)]); }
+    inline int value(int cat) { return extend(rd.getBits(cat), cat); }
+};
+
+// Decode one block: its DC, predicted from `pred`, goes to `dc` and its AC
+// pairs are appended to `ac` (without the end-of-block marker). Returns an
+// error message for a corrupt stream, nullptr otherwise.
+template <class Source>
+static inline const char* decodeBlock(Source& in, int pred, int16_t& dc, vector<RunLevel>& ac) {
+    // Reconstruct DC coefficient from its DPCM difference
+    int cat = in.dc();
+    if (cat < 0)
+        return "invalid DC code";
+    dc = static_cast<int16_t>(pred + in.value(cat));
+
+    // Collect (run, level) pairs until End of Block (EOB).
+    // The encoder always terminates a block with EOB, even when
+    // the last coefficient is nonzero.
+    int k = 0, run = 0;
+    for (;;) {
+        int symbol = in.ac(acBand(k));
+        if (symbol < 0)
+            return "invalid AC code";
+        if (symbol == 0) break;
+
+        run += symbol / 11;
+        cat = symbol % 11;
+        if (cat == 0) { // ZRL: a run of 15 zeros, which a coefficient must follow
+            if (k + run >= 63)
+                return "AC run past end of block";
+            continue;
         }
+        k += run + 1;
+        if (k > 63)
+            return "AC run past end of block";
+        ac.push_back({static_cast<uint8_t>(run), static_cast<int16_t>(in.value(cat))});
+        run = 0;
     }
+    return nullptr;
+}
 
-    // Reconstruct image from decoded coefficients
-    vector<int> imgOut;
-    if (gray) imgOut.resize(framesize);
-    else imgOut.resize(framesize * 3 / 2); // Account for chroma subsampling
-
-    // Decode luminance blocks
-    for (int y = 0; y < height; y += 8) {
-        for (int x = 0; x < width; x += 8) {
-            int idx = y * width + x;
-            int idx0 = (y / 8 * width / 8 + x / 8) * 64;
-
-            // Reconstruct DC coefficient
-            if (idx == 0)
-                imgOut[idx] = decoded[idx0];
-            else if (x == 0)
-                imgOut[idx] = imgOut[idx - width * 8] + decoded[idx0];
-            else
-                imgOut[idx] = imgOut[idx - 8] + decoded[idx0];
-
-            // Place remaining AC coefficients in zigzag order
-            for (int i = 0; i < 8; ++i) {
-                for (int j = 0; j < 8; ++j) {
-                    int k = i * 8 + j;
-                    if (k == 0) continue; // DC already handled
-                    int idx2 = y * width + x + zigzagIndex[k][0] + zigzagIndex[k][1] * width;
-                    imgOut[idx2] = decoded[idx0 + k];
-                }
-            }
+// Decode block rows [by0, by1) of one coefficient plane; mirror of encodeRows().
+// Returns false on a corrupt stream, leaving the rest of the row empty.
+template <class Source>
+static bool decodeRows(Source in, SparseCoefs& img, bool chroma, int by0, int by1, int pred0) {
+    for (int by = by0; by < by1; ++by) {
+        CoefRow& row = img.row(chroma, by);
+        const size_t blocks = row.dc.size();
+        row.ac.clear();
+
+        // End the current and all remaining blocks of the row
+        auto fail = [&](size_t bx, const char* msg) {
+            row.ac.insert(row.ac.end(), blocks - bx, RunLevel{0, 0});
+            cerr << "Decoding error: " << msg << ".\n";
+            return false;
+        };
+
+        for (size_t bx = 0; bx < blocks; ++bx) {
+            int pred = (by == by0 && bx == 0) ? pred0
+                     : (bx == 0) ? img.row(chroma, by - 1).dc[0]
+                                 : row.dc[bx - 1];
+            if (const char* err = decodeBlock(in, pred, row.dc[bx], row.ac))
+                return fail(bx, err);
+            row.ac.push_back({0, 0});
         }
     }
+    return true;
+}
 
-    // Decode chrominance blocks if not grayscale
-    if (!gray) {
-        for (int y = 0; y < height; y += 8) {
-            for (int x = 0; x < width / 2; x += 8) {
-                int idx = y * width / 2 + x + framesize;
-                int idx0 = (y / 8 * width / 16 + x / 8) * 64 + framesize;
-
-                // Reconstruct DC coefficient
-                if (idx == 0)
-                    imgOut[idx] = decoded[idx0];
-                else if (x == 0)
-                    imgOut[idx] = imgOut[idx - width * 4] + decoded[idx0];
-                else
-                    imgOut[idx] = imgOut[idx - 8] + decoded[idx0];
-
-                // Place AC coefficients
-                for (int i = 0; i < 8; ++i) {
-                    for (int j = 0; j < 8; ++j) {
-                        int k = i * 8 + j;
-                        if (k == 0) continue;
-                        int idx2 = y * width / 2 + framesize + x + zigzagIndex[k][0] + zigzagIndex[k][1] * width / 2;
-                        imgOut[idx2] = decoded[idx0 + k];
-                    }
-                }
-            }
-        }
+// A rANS stream must end exactly where its symbols do
+static bool ransFinished(const RansDecoder& rd) {
+    if (rd.finished())
+        return true;
+    cerr << "Decoding error: rANS stream does not end with its last symbol.\n";
+    return false;
+}
+
+// Decode an unsliced bitstream into `img` (sized for the frame). Returns
+// false on a corrupt stream; rows after the error keep their old contents.
+bool ACDCdecode(const unsigned char* data, size_t size, SparseCoefs& img, int height, Sampling s,
+                const EntropyTables& t) {
+    const int lumaRows = height / 8, chromaRows = 2 * chromaHeight(height, s) / 8;
+
+    // Decode luminance blocks, then the stacked chrominance plane
+    if (t.coder == RANS) {
+        RansDecoder rd(data, size);
+        if (!decodeRows(RansSource{rd, *t.rans, false}, img, false, 0, lumaRows, 0))
+            return false;
+        if (s != GRAY && !decodeRows(RansSource{rd, *t.rans, true}, img, true, 0, chromaRows, legacyChromaPred(img)))
+            return false;
+        return ransFinished(rd);
     }
 
+    BitReader br(data, size);
+    if (!decodeRows(HuffmanSource{br, t.dLuDC, t.dLuAC}, img, false, 0, lumaRows, 0))
+        return false;
+    return s == GRAY ||
+           decodeRows(HuffmanSource{br, t.dChDC, t.dChAC}, img, true, 0, chromaRows, legacyChromaPred(img));
+}
+
+SparseCoefs ACDCdecode(const vector<unsigned char>& data, int height, int width, Sampling s,
+                       const EntropyTables& t) {
+    SparseCoefs imgOut(height, width, s);
+    ACDCdecode(data.data(), data.size(), imgOut, height, s, t);
     return imgOut;
 }
+
+// Decode one restart slice (see DCACslice) into `img`
+bool ACDCdecodeSlice(const unsigned char* data, size_t size, SparseCoefs& img,
+                     int height, int width, Sampling s, int mcu0, int mcu1, const EntropyTables& t) {
+    if (t.coder == RANS) {
+        RansDecoder rd(data, size);
+        for (const PlaneRows& p : sliceRows(height, width, s, mcu0, mcu1))
+            if (!decodeRows(RansSource{rd, *t.rans, p.chroma}, img, p.chroma, p.row0, p.row1, 0))
+                return false;
+        return ransFinished(rd);
+    }
+
+    BitReader br(data, size);
+    for (const PlaneRows& p : sliceRows(height, width, s, mcu0, mcu1))
+        if (!decodeRows(p.chroma ? HuffmanSource{br, t.dChDC, t.dChAC} : HuffmanSource{br, t.dLuDC, t.dLuAC},
+                        img, p.chroma, p.row0, p.row1, 0))
+            return false;
+    return true;
+}
+
+// Decode the blocks of `row` from the block index entry `at`: decoding starts
+// at the entry's bit offset with its DC predictor, the first `skip` blocks
+// are decoded and dropped, and the next row.dc.size() are stored
+bool ACDCdecodeBlocks(const unsigned char* data, size_t size, const IndexEntry& at, int skip, CoefRow& row,
+                      const HuffDecoder& DC, const HuffDecoder& AC) {
+    const size_t byte = min<uint64_t>(at.bit / 8, size);
+    BitReader br(data + byte, size - byte);
+    br.get(at.bit % 8);
+    HuffmanSource in{br, DC, AC};
+
+    const int blocks = static_cast<int>(row.dc.size());
+    row.ac.clear();
+    int16_t dc = at.pred;   // The last DC, predicting the next one
+    for (int bx = -skip; bx < blocks; ++bx) {
+        const char* err = decodeBlock(in, dc, dc, row.ac);
+        if (bx < 0) {
+            row.ac.clear();
+        } else {
+            row.dc[bx] = dc;
+            if (!err)
+                row.ac.push_back({0, 0});
+        }
+        if (err) {
+            row.ac.insert(row.ac.end(), blocks - max(bx, 0), RunLevel{0, 0});
+            cerr << "Decoding error: " << err << ".\n";
+            return false;
+        }
+    }
+    return true;
+}
\ No newline at end of file
@@ -1,16 +1,4 @@
-int zigzagIndex[64][2] = {
-    {0,0},{0,1},{1,0},{2,0},{1,1},{0,2},{0,3},{1,2},
-    {2,1},{3,0},{4,0},{3,1},{2,2},{1,3},{0,4},{0,5},
-    {1,4},{2,3},{3,2},{4,1},{5,0},{6,0},{5,1},{4,2},
-    {3,3},{2,4},{1,5},{0,6},{0,7},{1,6},{2,5},{3,4},
-    {4,
-    3},{5,2},{6,1},{7,0},{7,1},{6,2},{5,3},{4,4},
-    {3,5},{2,6},{1,7},{2,7},{3,6},{4,5},{5,4},{6,3},
-    {7,2},{7,3},{6,4},{5,5},{4,6},{3,7},{4,7},{5,6},
-    {6,5},{7,4},{7,5},{6,6},{5,7},{6,7},{7,6},{7,7}
-};
-
-const char* luminanceDC[12] = {
+constexpr const char* luminanceDC[12] = {
     "00",
     "010",
     "011",
@@ -25,7 +13,7 @@ const char* luminanceDC[12] = {
     "111111110"
 };
 
-const char* chrominanceDC[12] = {
+constexpr const char* chrominanceDC[12] = {
     "00",
     "01",
     "10",
@@ -40,7 +28,7 @@ const char* chrominanceDC[12] = {
     "11111111110",
 };
 
-const char* luminanceAC[176] = {
+constexpr const char* luminanceAC[176] = {
     "1010",
     "00",
     "01",
@@ -234,7 +222,7 @@ const char* luminanceAC[176] = {
     "1111111111111110"
 };
 
-const char* chrominanceAC[176] = {
+constexpr const char* chrominanceAC[176] = {
     "00",
     "01",
     "100",
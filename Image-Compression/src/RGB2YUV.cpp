@@ -1,81 +1,186 @@
 #include "myimage.h"
 
-vector<unsigned char> RGB2YUV(const vector<unsigned char>& imageRGB, int width = 0, int height = 0) {
-
-    vector<unsigned char> imageY, imageU, imageV;
-
-    imageY.resize(width * height);
-    imageU.resize(width * height / 4);
-    imageV.resize(width * height / 4);
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            int idx = y * width + x;
-            int r = imageRGB[3 * idx];
-            int g = imageRGB[3 * idx + 1];
-            int b = imageRGB[3 * idx + 2];
-
-            int Y = r * 0.299000 + g * 0.587000 + b * 0.114000;
-            int U = r *-0.168736 + g *-0.331264 + b * 0.500000 + 128;
-            int V = r * 0.500000 + g *-0.418688 + b *-0.081312 + 128;
-
-
-            imageY[idx] = static_cast<unsigned char>(Y);
+// Color conversion between interleaved RGB and the planar frame (the Y plane,
+// then U, then V). Both directions run one chroma row at a time: the encoder
+// takes the luma of its one or two image rows and the U and V of each 2x2
+// (4:2:0), 2x1 (4:2:2) or single (4:4:4) pixel group from the group's average
+// color; the decoder repeats each chroma sample over its group. The AVX2 row
+// kernels (RGB2YUVavx2.cpp) give the same bytes as the scalar rows here.
+
+// Fixed-point conversion constants: the BT.601 coefficients scaled by 2^16
+#define SCALEBITS 16
+#define ONE_HALF  (1 << (SCALEBITS - 1))
+#define CBCR_OFFSET (128 << SCALEBITS)
+
+#ifdef HAVE_AVX2
+int RGB2YUVRowAVX2(const unsigned char* rgb, int width, int rows, int cols,
+                   unsigned char* Y, unsigned char* U, unsigned char* V);
+int YUV2RGBRowAVX2(const unsigned char* Y, const unsigned char* U, const unsigned char* V,
+                   int width, int cols, unsigned char* rgb);
+#endif
+
+// Pixels [x0, width) of one chroma row: `rows` image rows at `rgb`, and each
+// U and V sample from the average of `cols` x `rows` pixels
+static void RGB2YUVRow(const unsigned char* rgb, int width, int rows, int cols, int x0,
+                       unsigned char* Y, unsigned char* U, unsigned char* V) {
+    const float norm = 1.0f / (rows * cols);
+    for (int x = x0; x < width; x += cols) {
+        int R = 0, G = 0, B = 0;
+        for (int j = 0; j < rows; ++j) {
+            for (int i = 0; i < cols; ++i) {
+                size_t idx = size_t(j) * width + x + i;
+                int r = rgb[3 * idx];
+                int g = rgb[3 * idx + 1];
+                int b = rgb[3 * idx + 2];
+                Y[idx] = static_cast<unsigned char>(r * 0.299f + g * 0.587f + b * 0.114f + 0.5f);
+                R += r;
+                G += g;
+                B += b;
+            }
+        }
 
+        float r = R * norm, g = G * norm, b = B * norm;
+        int u = static_cast<int>(r * -0.168736f + g * -0.331264f + b * 0.5f + 128.5f);
+        int v = static_cast<int>(r * 0.5f + g * -0.418688f + b * -0.081312f + 128.5f);
+        U[x / cols] = static_cast<unsigned char>(clamp(u, 0, 255));
+        V[x / cols] = static_cast<unsigned char>(clamp(v, 0, 255));
+    }
+}
 
-            if (y % 2 == 0 && x % 2 == 0) {
-                int groupIdx = (y / 2) * (width / 2) + (x / 2);
-                imageU[groupIdx] = static_cast<unsigned char>(U);
-                imageV[groupIdx] = static_cast<unsigned char>(V);
+// Integer-only version of RGB2YUVRow, rounding to nearest like it
+static void RGB2YUVRowFixed(const unsigned char* rgb, int width, int rows, int cols,
+                            unsigned char* Y, unsigned char* U, unsigned char* V) {
+    const int shift = (rows - 1) + (cols - 1);   // log2 of the pixels per chroma sample
+    for (int x = 0; x < width; x += cols) {
+        int R = 0, G = 0, B = 0;
+        for (int j = 0; j < rows; ++j) {
+            for (int i = 0; i < cols; ++i) {
+                size_t idx = size_t(j) * width + x + i;
+                int r = rgb[3 * idx];
+                int g = rgb[3 * idx + 1];
+                int b = rgb[3 * idx + 2];
+                Y[idx] = static_cast<unsigned char>((19595 * r + 38470 * g + 7471 * b + ONE_HALF) >> SCALEBITS);
+                R += r;
+                G += g;
+                B += b;
             }
         }
+
+        const int offset = (CBCR_OFFSET + ONE_HALF) << shift;
+        int u = (-11059 * R - 21709 * G + 32768 * B + offset) >> (SCALEBITS + shift);
+        int v = (32768 * R - 27439 * G - 5329 * B + offset) >> (SCALEBITS + shift);
+        U[x / cols] = static_cast<unsigned char>(clamp(u, 0, 255));
+        V[x / cols] = static_cast<unsigned char>(clamp(v, 0, 255));
     }
+}
 
-    vector<unsigned char> imageYUV;
-    imageYUV.reserve(width * height + width * height / 2);
-    imageYUV.insert(imageYUV.end(), imageY.begin(), imageY.end());
-    imageYUV.insert(imageYUV.end(), imageU.begin(), imageU.end());
-    imageYUV.insert(imageYUV.end(), imageV.begin(), imageV.end());
+// RGB -> planar YUV with sampling `s` into `imageYUV` (frameSamples(height, width, s) bytes)
+void RGB2YUV(const unsigned char* imageRGB, int width, int height, Sampling s, unsigned char* imageYUV) {
+    const int rows = s == YUV420 ? 2 : 1;
+    const int cols = s == YUV444 ? 1 : 2;
+    const int cw = chromaWidth(width, s);
+    const bool fixed = fixedPointMode();
+
+    unsigned char* imageU = imageYUV + size_t(width) * height;
+    unsigned char* imageV = imageU + size_t(cw) * chromaHeight(height, s);
+
+    for (int y = 0; y < height; y += rows) {
+        const unsigned char* rgb = imageRGB + size_t(y) * width * 3;
+        unsigned char* Y = imageYUV + size_t(y) * width;
+        unsigned char* U = imageU + size_t(y / rows) * cw;
+        unsigned char* V = imageV + size_t(y / rows) * cw;
+
+        if (fixed) {
+            RGB2YUVRowFixed(rgb, width, rows, cols, Y, U, V);
+            continue;
+        }
+        int x0 = 0;
+#ifdef HAVE_AVX2
+        if (simdMode())
+            x0 = RGB2YUVRowAVX2(rgb, width, rows, cols, Y, U, V);
+#endif
+        RGB2YUVRow(rgb, width, rows, cols, x0, Y, U, V);
+    }
+}
 
+vector<unsigned char> RGB2YUV(const vector<unsigned char>& imageRGB, int width, int height, Sampling s) {
+    vector<unsigned char> imageYUV(frameSamples(height, width, s));
+    RGB2YUV(imageRGB.data(), width, height, s, imageYUV.data());
     return imageYUV;
 }
 
-vector<unsigned char> YUV2RGB(const vector<unsigned char>& imageYUV, int width = 0, int height = 0) {
-
-    const int frameSize = width * height;
-    const int chromaWidth = width / 2;
-    const int chromaHeight = height / 2;
-
-    const unsigned char* Y_plane = imageYUV.data();
-    const unsigned char* U_plane = Y_plane + frameSize;
-    const unsigned char* V_plane = U_plane + (frameSize / 4);
-
-    vector<unsigned char> imageRGB;
-    imageRGB.resize(frameSize * 3);
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            int idx = y * width + x;
-            int chromaIdx = (y / 2) * chromaWidth + (x / 2);
-
-            int Y = Y_plane[idx];
-            int U = U_plane[chromaIdx];
-            int V = V_plane[chromaIdx];
-
-            // Convert YUV to RGB using float math and clamp the result
-            float c = Y;
-            float d = U - 128;
-            float e = V - 128;
+// Pixels [x0, width) of one image row, each U and V sample covering `cols` pixels
+static void YUV2RGBRow(const unsigned char* Y, const unsigned char* U, const unsigned char* V,
+                       int width, int cols, int x0, unsigned char* rgb) {
+    for (int x = x0; x < width; x += cols) {
+        // Chroma terms, shared by the pixels of the group
+        float d = U[x / cols] - 128;
+        float e = V[x / cols] - 128;
+        float re = 1.402f * e, gd = 0.344136f * d, ge = 0.714136f * e, bd = 1.772f * d;
+
+        for (int i = 0; i < cols && x + i < width; ++i) {
+            float c = Y[x + i];
+            unsigned char* p = rgb + 3 * (x + i);
+            p[0] = static_cast<unsigned char>(clamp(static_cast<int>(c + re + 0.5f), 0, 255));
+            p[1] = static_cast<unsigned char>(clamp(static_cast<int>(c - gd - ge + 0.5f), 0, 255));
+            p[2] = static_cast<unsigned char>(clamp(static_cast<int>(c + bd + 0.5f), 0, 255));
+        }
+    }
+}
 
-            int R = clamp(static_cast<int>(c + 1.402f * e + 0.5f), 0, 255);
-            int G = clamp(static_cast<int>(c - 0.344136f * d - 0.714136f * e + 0.5f), 0, 255);
-            int B = clamp(static_cast<int>(c + 1.772f * d + 0.5f), 0, 255);
+// Integer-only YUV -> RGB row with rounding and clamping
+static void YUV2RGBRowFixed(const unsigned char* Y, const unsigned char* U, const unsigned char* V,
+                            int width, int cols, unsigned char* rgb) {
+    for (int x = 0; x < width; ++x) {
+        int c = (Y[x] << SCALEBITS) + ONE_HALF;
+        int d = U[x / cols] - 128;
+        int e = V[x / cols] - 128;
+
+        rgb[3 * x    ] = static_cast<unsigned char>(clamp((c + 91881 * e) >> SCALEBITS, 0, 255));
+        rgb[3 * x + 1] = static_cast<unsigned char>(clamp((c - 22554 * d - 46802 * e) >> SCALEBITS, 0, 255));
+        rgb[3 * x + 2] = static_cast<unsigned char>(clamp((c + 116130 * d) >> SCALEBITS, 0, 255));
+    }
+}
 
-            imageRGB[3 * idx    ] = static_cast<unsigned char>(R);
-            imageRGB[3 * idx + 1] = static_cast<unsigned char>(G);
-            imageRGB[3 * idx + 2] = static_cast<unsigned char>(B);
+// Planar YUV with sampling `s` -> RGB of the top left outWidth x outHeight
+// pixels into `imageRGB` (outWidth * outHeight * 3 bytes), which drops the
+// padding of a padded frame without a separate crop
+void YUV2RGB(const unsigned char* imageYUV, int width, int height, Sampling s, unsigned char* imageRGB,
+             int outWidth, int outHeight) {
+    const int rows = s == YUV420 ? 2 : 1;
+    const int cols = s == YUV444 ? 1 : 2;
+    const int cw = chromaWidth(width, s);
+    const bool fixed = fixedPointMode();
+
+    const unsigned char* U_plane = imageYUV + size_t(width) * height;
+    const unsigned char* V_plane = U_plane + size_t(cw) * chromaHeight(height, s);
+
+    for (int y = 0; y < outHeight; ++y) {
+        const unsigned char* Y = imageYUV + size_t(y) * width;
+        const unsigned char* U = U_plane + size_t(y / rows) * cw;
+        const unsigned char* V = V_plane + size_t(y / rows) * cw;
+        unsigned char* rgb = imageRGB + size_t(y) * outWidth * 3;
+
+        if (fixed) {
+            YUV2RGBRowFixed(Y, U, V, outWidth, cols, rgb);
+            continue;
         }
+        int x0 = 0;
+#ifdef HAVE_AVX2
+        if (simdMode())
+            x0 = YUV2RGBRowAVX2(Y, U, V, outWidth, cols, rgb);
+#endif
+        YUV2RGBRow(Y, U, V, outWidth, cols, x0, rgb);
     }
+}
+
+// Planar YUV with sampling `s` -> RGB into `imageRGB` (width * height * 3 bytes)
+void YUV2RGB(const unsigned char* imageYUV, int width, int height, Sampling s, unsigned char* imageRGB) {
+    YUV2RGB(imageYUV, width, height, s, imageRGB, width, height);
+}
 
+vector<unsigned char> YUV2RGB(const vector<unsigned char>& imageYUV, int width, int height, Sampling s) {
+    vector<unsigned char> imageRGB(size_t(width) * height * 3);
+    YUV2RGB(imageYUV.data(), width, height, s, imageRGB.data());
     return imageRGB;
 }
\ No newline at end of file
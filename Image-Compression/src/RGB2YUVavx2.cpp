@@ -0,0 +1,172 @@
+/* AVX2 versions of the row kernels in RGB2YUV.cpp */
+/* 16 pixels are handled per step: pshufb gathers the R, G and B bytes of 48
+interleaved bytes into three registers (and scatters them back on output),
+and each channel is widened to two __m256 of eight floats. Every lane performs
+exactly the float operations of the scalar code, in the same order, and the
+chroma sums are exact integers, so both paths produce bit-identical results.
+The kernels return the number of pixels done; the scalar code finishes the
+row. */
+
+#include "myimage.h"
+
+#ifdef HAVE_AVX2
+
+#include <immintrin.h>
+
+#define AVX2_FN __attribute__((target("avx2")))
+
+/* Split 16 interleaved RGB pixels into their R, G and B bytes */
+AVX2_FN static inline void deinterleave(const unsigned char *src, __m128i *r, __m128i *g, __m128i *b)
+{
+  const __m128i in0 = _mm_loadu_si128((const __m128i *)src);
+  const __m128i in1 = _mm_loadu_si128((const __m128i *)(src + 16));
+  const __m128i in2 = _mm_loadu_si128((const __m128i *)(src + 32));
+
+  *r = _mm_or_si128(_mm_or_si128(
+         _mm_shuffle_epi8(in0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+         _mm_shuffle_epi8(in1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+         _mm_shuffle_epi8(in2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+  *g = _mm_or_si128(_mm_or_si128(
+         _mm_shuffle_epi8(in0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+         _mm_shuffle_epi8(in1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+         _mm_shuffle_epi8(in2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+  *b = _mm_or_si128(_mm_or_si128(
+         _mm_shuffle_epi8(in0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+         _mm_shuffle_epi8(in1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+         _mm_shuffle_epi8(in2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+/* Store the R, G and B bytes of 16 pixels as 48 interleaved bytes */
+AVX2_FN static inline void interleave(__m128i r, __m128i g, __m128i b, unsigned char *dst)
+{
+  __m128i out0 = _mm_or_si128(_mm_or_si128(
+         _mm_shuffle_epi8(r, _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5)),
+         _mm_shuffle_epi8(g, _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1))),
+         _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1)));
+  __m128i out1 = _mm_or_si128(_mm_or_si128(
+         _mm_shuffle_epi8(r, _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1)),
+         _mm_shuffle_epi8(g, _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10))),
+         _mm_shuffle_epi8(b, _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1)));
+  __m128i out2 = _mm_or_si128(_mm_or_si128(
+         _mm_shuffle_epi8(r, _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1)),
+         _mm_shuffle_epi8(g, _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1))),
+         _mm_shuffle_epi8(b, _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15)));
+  _mm_storeu_si128((__m128i *)dst, out0);
+  _mm_storeu_si128((__m128i *)(dst + 16), out1);
+  _mm_storeu_si128((__m128i *)(dst + 32), out2);
+}
+
+/* Truncate two vectors of eight floats and saturate them to 16 bytes */
+AVX2_FN static inline __m128i packBytes(__m256 a, __m256 b)
+{
+  __m256i ia = _mm256_cvttps_epi32(a), ib = _mm256_cvttps_epi32(b);
+  __m128i lo = _mm_packs_epi32(_mm256_castsi256_si128(ia), _mm256_extracti128_si256(ia, 1));
+  __m128i hi = _mm_packs_epi32(_mm256_castsi256_si128(ib), _mm256_extracti128_si256(ib, 1));
+  return _mm_packus_epi16(lo, hi);
+}
+
+/* Bytes 0-7 (half 0) or 8-15 (half 1) of v as eight floats */
+AVX2_FN static inline __m256 widen(__m128i v, int half)
+{
+  return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(half ? _mm_srli_si128(v, 8) : v));
+}
+
+AVX2_FN static inline __m256 luma(__m256 r, __m256 g, __m256 b)
+{
+  __m256 y = _mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(0.299f)), _mm256_mul_ps(g, _mm256_set1_ps(0.587f)));
+  y = _mm256_add_ps(y, _mm256_mul_ps(b, _mm256_set1_ps(0.114f)));
+  return _mm256_add_ps(y, _mm256_set1_ps(0.5f));
+}
+
+/* U and V of eight chroma samples from their R, G and B sums */
+AVX2_FN static inline void chroma(__m256i sr, __m256i sg, __m256i sb, float norm,
+                                  unsigned char *U, unsigned char *V)
+{
+  const __m256 n = _mm256_set1_ps(norm);
+  __m256 r = _mm256_mul_ps(_mm256_cvtepi32_ps(sr), n);
+  __m256 g = _mm256_mul_ps(_mm256_cvtepi32_ps(sg), n);
+  __m256 b = _mm256_mul_ps(_mm256_cvtepi32_ps(sb), n);
+
+  __m256 u = _mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(-0.168736f)), _mm256_mul_ps(g, _mm256_set1_ps(-0.331264f)));
+  u = _mm256_add_ps(_mm256_add_ps(u, _mm256_mul_ps(b, _mm256_set1_ps(0.5f))), _mm256_set1_ps(128.5f));
+  __m256 v = _mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(0.5f)), _mm256_mul_ps(g, _mm256_set1_ps(-0.418688f)));
+  v = _mm256_add_ps(_mm256_add_ps(v, _mm256_mul_ps(b, _mm256_set1_ps(-0.081312f))), _mm256_set1_ps(128.5f));
+
+  _mm_storel_epi64((__m128i *)U, packBytes(u, u));
+  _mm_storel_epi64((__m128i *)V, packBytes(v, v));
+}
+
+AVX2_FN int RGB2YUVRowAVX2(const unsigned char *rgb, int width, int rows, int cols,
+                           unsigned char *Y, unsigned char *U, unsigned char *V)
+{
+  const float norm = 1.0f / (rows * cols);
+  int x;
+  for (x = 0; x + 16 <= width; x += 16) {
+    __m256i sr = _mm256_setzero_si256(), sg = sr, sb = sr;   /* 16-bit column sums */
+    for (int j = 0; j < rows; j++) {
+      __m128i r, g, b;
+      deinterleave(rgb + 3 * (size_t(j) * width + x), &r, &g, &b);
+      __m256 y0 = luma(widen(r, 0), widen(g, 0), widen(b, 0));
+      __m256 y1 = luma(widen(r, 1), widen(g, 1), widen(b, 1));
+      _mm_storeu_si128((__m128i *)(Y + size_t(j) * width + x), packBytes(y0, y1));
+      sr = _mm256_add_epi16(sr, _mm256_cvtepu8_epi16(r));
+      sg = _mm256_add_epi16(sg, _mm256_cvtepu8_epi16(g));
+      sb = _mm256_add_epi16(sb, _mm256_cvtepu8_epi16(b));
+    }
+    if (cols == 1) {
+      for (int h = 0; h < 2; h++)
+        chroma(_mm256_cvtepi16_epi32(h ? _mm256_extracti128_si256(sr, 1) : _mm256_castsi256_si128(sr)),
+               _mm256_cvtepi16_epi32(h ? _mm256_extracti128_si256(sg, 1) : _mm256_castsi256_si128(sg)),
+               _mm256_cvtepi16_epi32(h ? _mm256_extracti128_si256(sb, 1) : _mm256_castsi256_si128(sb)),
+               norm, U + x + 8 * h, V + x + 8 * h);
+    } else {
+      /* Add horizontal pairs: eight 32-bit sums, in order */
+      const __m256i one = _mm256_set1_epi16(1);
+      chroma(_mm256_madd_epi16(sr, one), _mm256_madd_epi16(sg, one), _mm256_madd_epi16(sb, one),
+             norm, U + x / 2, V + x / 2);
+    }
+  }
+  return x;
+}
+
+AVX2_FN int YUV2RGBRowAVX2(const unsigned char *Y, const unsigned char *U, const unsigned char *V,
+                           int width, int cols, unsigned char *rgb)
+{
+  const __m256 half = _mm256_set1_ps(0.5f), bias = _mm256_set1_ps(128.0f);
+  const __m256i dup0 = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+  const __m256i dup1 = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+  int x;
+  for (x = 0; x + 16 <= width; x += 16) {
+    __m128i yb = _mm_loadu_si128((const __m128i *)(Y + x));
+    __m256 d[2], e[2];
+    if (cols == 1) {
+      __m128i ub = _mm_loadu_si128((const __m128i *)(U + x));
+      __m128i vb = _mm_loadu_si128((const __m128i *)(V + x));
+      for (int h = 0; h < 2; h++) {
+        d[h] = _mm256_sub_ps(widen(ub, h), bias);
+        e[h] = _mm256_sub_ps(widen(vb, h), bias);
+      }
+    } else {
+      /* Each chroma sample covers two pixels */
+      __m256 du = _mm256_sub_ps(widen(_mm_loadl_epi64((const __m128i *)(U + x / 2)), 0), bias);
+      __m256 ev = _mm256_sub_ps(widen(_mm_loadl_epi64((const __m128i *)(V + x / 2)), 0), bias);
+      d[0] = _mm256_permutevar8x32_ps(du, dup0);
+      d[1] = _mm256_permutevar8x32_ps(du, dup1);
+      e[0] = _mm256_permutevar8x32_ps(ev, dup0);
+      e[1] = _mm256_permutevar8x32_ps(ev, dup1);
+    }
+
+    __m256 r[2], g[2], b[2];
+    for (int h = 0; h < 2; h++) {
+      __m256 c = widen(yb, h);
+      r[h] = _mm256_add_ps(_mm256_add_ps(c, _mm256_mul_ps(_mm256_set1_ps(1.402f), e[h])), half);
+      g[h] = _mm256_sub_ps(c, _mm256_mul_ps(_mm256_set1_ps(0.344136f), d[h]));
+      g[h] = _mm256_add_ps(_mm256_sub_ps(g[h], _mm256_mul_ps(_mm256_set1_ps(0.714136f), e[h])), half);
+      b[h] = _mm256_add_ps(_mm256_add_ps(c, _mm256_mul_ps(_mm256_set1_ps(1.772f), d[h])), half);
+    }
+    interleave(packBytes(r[0], r[1]), packBytes(g[0], g[1]), packBytes(b[0], b[1]), rgb + 3 * x);
+  }
+  return x;
+}
+
+#endif
\ No newline at end of file
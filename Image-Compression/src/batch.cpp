@@ -0,0 +1,69 @@
+#include <chrono>
+#include <sstream>
+
+#include "myimage.h"
+
+// Batch mode (encode/decode -batch MANIFEST): many files in one process. The
+// files are shared out to a fixed pool of worker threads, each of which keeps
+// one BatchContext for all its files, and the standard Huffman tables are
+// built once for the process (defaultTables). A summary with the aggregate
+// throughput is printed at the end.
+
+// Read a manifest: one "input output [width height]" entry per line. Blank
+// lines and lines starting with '#' are skipped; width and height are only
+// read by the encoder (0 when absent).
+bool readManifest(const string& file, vector<BatchJob>& jobs) {
+    ifstream in(file);
+    if (!in) {
+        cerr << "Failed to open " << file << endl;
+        return false;
+    }
+    string line;
+    for (int n = 1; getline(in, line); ++n) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        size_t first = line.find_first_not_of(" \t");
+        if (first == string::npos || line[first] == '#')
+            continue;
+        istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.input >> job.output)) {
+            cerr << file << ":" << n << ": expected an input and an output file.\n";
+            return false;
+        }
+        if (fields >> job.width && !(fields >> job.height)) {
+            cerr << file << ":" << n << ": expected a width and a height.\n";
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// Run `fn` on every job on `threads` worker threads (0: all cores). `fn`
+// returns the number of raw image bytes it read or wrote, 0 on failure.
+// Returns true if every job succeeded.
+bool runBatch(const vector<BatchJob>& jobs, int threads,
+              const function<uint64_t(const BatchJob&, BatchContext&)>& fn) {
+    auto start = chrono::steady_clock::now();
+    ThreadPool pool(threads);
+    vector<BatchContext> contexts(pool.size());
+    atomic<uint64_t> rawBytes(0);
+    atomic<int> failed(0);
+
+    pool.parallelForWorker(int(jobs.size()), [&](int i, int worker) {
+        uint64_t bytes = fn(jobs[i], contexts[worker]);
+        if (bytes == 0) {
+            cerr << "Failed: " << jobs[i].input << endl;
+            ++failed;
+        }
+        rawBytes += bytes;
+    });
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double mb = rawBytes / 1e6;
+    cout << "Batch: " << jobs.size() << " files (" << failed << " failed), " << mb << " MB of raw images in "
+         << seconds << " s on " << pool.size() << " threads: " << mb / seconds << " MB/s, "
+         << jobs.size() / seconds << " files/s" << endl;
+    return failed == 0;
+}
\ No newline at end of file
@@ -0,0 +1,119 @@
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Packs variable-length codes MSB-first into bytes.
+// Bits are collected in a 64-bit accumulator and emitted 32 at a time, either
+// into a caller-owned byte buffer or, when a stream is attached, drained to the
+// stream every few KB so memory stays bounded by the chunk size.
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<unsigned char>& out) : buf(out), os(nullptr) {}
+    explicit BitWriter(std::ostream& stream) : buf(own), os(&stream) { own.reserve(CHUNK + 8); }
+    ~BitWriter() { drain(); }
+
+    // Append the low `len` bits of `bits` (0 <= len <= 32)
+    inline void put(uint32_t bits, int len) {
+        acc = (acc << len) | (bits & mask(len));
+        n += len;
+        if (n >= 32) {
+            n -= 32;
+            uint32_t w = static_cast<uint32_t>(acc >> n);
+            buf.push_back(static_cast<unsigned char>(w >> 24));
+            buf.push_back(static_cast<unsigned char>(w >> 16));
+            buf.push_back(static_cast<unsigned char>(w >> 8));
+            buf.push_back(static_cast<unsigned char>(w));
+            total += 32;
+            if (os && buf.size() >= CHUNK) drain();
+        }
+    }
+
+    // Pad the last partial byte with zero bits and write out everything pending
+    void flush() {
+        total += n;
+        while (n >= 8) {
+            n -= 8;
+            buf.push_back(static_cast<unsigned char>(acc >> n));
+        }
+        if (n > 0) {
+            buf.push_back(static_cast<unsigned char>(acc << (8 - n)));
+            total += 8 - n;
+            n = 0;
+        }
+        drain();
+    }
+
+    // Number of bits written so far (including pending ones)
+    uint64_t bitCount() const { return total + n; }
+
+private:
+    static const size_t CHUNK = 1 << 16;
+
+    static inline uint64_t mask(int len) { return (uint64_t(1) << len) - 1; }
+
+    void drain() {
+        if (os && !buf.empty()) {
+            os->write(reinterpret_cast<const char*>(buf.data()), buf.size());
+            buf.clear();
+        }
+    }
+
+    std::vector<unsigned char> own;
+    std::vector<unsigned char>& buf;
+    std::ostream* os;
+    uint64_t acc = 0;
+    int n = 0;          // Number of valid bits in acc
+    uint64_t total = 0; // Bits already moved out of acc
+};
+
+// Reads MSB-first packed bits through a 64-bit register.
+// Reads past the end of the buffer return zero bits, matching the encoder's padding.
+class BitReader {
+public:
+    BitReader(const unsigned char* data, size_t size) : begin(data), p(data), end(data + size) {}
+
+    // Return the next `len` bits (1 <= len <= 32) without consuming them
+    inline uint32_t peek(int len) {
+        if (n < len) refill();
+        return static_cast<uint32_t>(acc >> (64 - len));
+    }
+
+    inline void skip(int len) {
+        acc <<= len;
+        n -= len;
+    }
+
+    // Consume and return the next `len` bits (0 <= len <= 32)
+    inline uint32_t get(int len) {
+        if (len == 0) return 0;
+        uint32_t v = peek(len);
+        skip(len);
+        return v;
+    }
+
+    // Number of bits consumed so far
+    uint64_t bitPosition() const { return (uint64_t)(p - begin + pastEnd) * 8 - n; }
+
+private:
+    void refill() {
+        while (n <= 56) {
+            uint64_t byte = 0;
+            if (p < end) byte = *p++;
+            else pastEnd++;
+            acc |= byte << (56 - n);
+            n += 8;
+        }
+    }
+
+    const unsigned char* begin;
+    const unsigned char* p;
+    const unsigned char* end;
+    uint64_t acc = 0;     // Pending bits, MSB aligned
+    int n = 0;            // Number of valid bits in acc
+    uint64_t pastEnd = 0; // Zero bytes supplied after the end of the buffer
+};
+
+#endif
\ No newline at end of file
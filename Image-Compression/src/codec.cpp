@@ -0,0 +1,207 @@
+#include <chrono>
+
+#include "codec.h"
+
+// Adds the time since the previous lap to one stage of `times`, if set
+class StageClock {
+public:
+    explicit StageClock(StageTimes* t) : times(t), last(chrono::steady_clock::now()) {}
+
+    void lap(double StageTimes::*stage) {
+        if (!times)
+            return;
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        times->*stage += chrono::duration<double, milli>(now - last).count();
+        last = now;
+    }
+
+private:
+    StageTimes* times;
+    chrono::steady_clock::time_point last;
+};
+
+// Run fn(s) for every restart slice s in [0, count): on `pool`, created for
+// `threads` threads on first use, or on the calling thread when threads == 1
+static void forSlices(unique_ptr<ThreadPool>& pool, int threads, int count, const function<void(int)>& fn) {
+    if (threads == 1 || count < 2) {
+        for (int s = 0; s < count; ++s)
+            fn(s);
+        return;
+    }
+    const int size = threads > 0 ? threads : int(max(1u, thread::hardware_concurrency()));
+    if (!pool || pool->size() != size)
+        pool.reset(new ThreadPool(size));
+    pool->parallelFor(count, fn);
+}
+
+// Tables a file is coded with, without copying the standard ones
+static const EntropyTables& codingTables(const ImageHeader& hdr, EntropyTables& custom) {
+    if (!hdr.customTables && hdr.coder == HUFFMAN)
+        return defaultTables();
+    custom = headerTables(hdr);
+    return custom;
+}
+
+size_t Encoder::encode(const unsigned char* pixels, int width, int height, Sampling sampling,
+                       unsigned char* out, size_t capacity) {
+    if (!validImageSize(width, height))
+        return 0;
+    const bool gray = sampling == GRAY;
+    const int channels = gray ? 1 : 3;
+    const int pwidth = paddedSize(width, gray);
+    const int pheight = paddedSize(height, gray);
+    const int mcuRows = pheight / (gray ? 8 : 16);
+    const size_t frameSize = size_t(pwidth) * pheight;
+
+    header.width = width;
+    header.height = height;
+    header.sampling = sampling;
+    header.quality = clamp(quality, 1, 100);
+    header.restart = clamp(restart, 0, mcuRows);
+    header.sliceOffsets.clear();
+    header.customTables = false;
+    header.coder = coder;
+    StageClock clock(times);
+
+    // Pad to whole MCUs (unless the image already is) and convert to YUV
+    const unsigned char* src = pixels;
+    if (pwidth != width || pheight != height) {
+        padded.resize(frameSize * channels);
+        padFrame(pixels, width, height, channels, pwidth, pheight, padded.data());
+        src = padded.data();
+    }
+    if (gray) {
+        frame.assign(src, src + frameSize);
+    } else {
+        frame.resize(frameSamples(pheight, pwidth, sampling));
+        RGB2YUV(src, pwidth, pheight, sampling, frame.data());
+    }
+    clock.lap(&StageTimes::color);
+
+    // Restart slices are independent: each step runs on all of them in parallel
+    const int nslices = sliceCount(pheight, gray, header.restart);
+    const int rows = header.restart ? header.restart : mcuRows;   // MCU rows per slice
+    fitCoefs(coef, pheight, pwidth, sampling);
+    forSlices(pool, threads, nslices, [&](int s) {
+        quantDct2Rows(frame, coef, qualityScale(header.quality), pheight, pwidth, sampling, s * rows,
+                      min(mcuRows, (s + 1) * rows));
+    });
+    clock.lap(&StageTimes::dct);
+
+    if (optimize || coder == RANS) {
+        SymbolStats stats;
+        if (header.restart == 0) {
+            DCAC(coef, pheight, sampling, stats);
+        } else {
+            vector<SymbolStats> sliceStats(nslices);
+            forSlices(pool, threads, nslices, [&](int s) {
+                DCACslice(coef, pheight, pwidth, sampling, s * rows, min(mcuRows, (s + 1) * rows), sliceStats[s]);
+            });
+            for (const SymbolStats& st : sliceStats)
+                stats.add(st);
+        }
+        optimizeTables(header, stats);
+    }
+    const EntropyTables& tables = codingTables(header, custom);
+
+    bits.clear();
+    if (header.restart == 0) {
+        BitWriter bw(bits);
+        DCAC(coef, pheight, sampling, tables, bw);
+        bw.flush();
+    } else {
+        // Slices go back to back, each starting on a byte boundary
+        slices.resize(nslices);
+        forSlices(pool, threads, nslices, [&](int s) {
+            slices[s].clear();
+            BitWriter bw(slices[s]);
+            DCACslice(coef, pheight, pwidth, sampling, s * rows, min(mcuRows, (s + 1) * rows), tables, bw);
+        });
+        header.sliceOffsets.resize(nslices);
+        for (int s = 0; s < nslices; ++s) {
+            header.sliceOffsets[s] = static_cast<uint32_t>(bits.size());
+            bits.insert(bits.end(), slices[s].begin(), slices[s].end());
+        }
+    }
+    head.clear();
+    writeHeader(head, header);
+
+    const size_t total = head.size() + bits.size();
+    if (total <= capacity) {
+        memcpy(out, head.data(), head.size());
+        memcpy(out + head.size(), bits.data(), bits.size());
+    }
+    clock.lap(&StageTimes::entropy);
+    return total;
+}
+
+bool Decoder::readInfo(const unsigned char* data, size_t size, ImageHeader& info) {
+    return readHeader(data, size, info) > 0;
+}
+
+size_t Decoder::decodedSize(const ImageHeader& info, int scale) {
+    return size_t((info.width + scale - 1) / scale) * ((info.height + scale - 1) / scale) * (info.gray() ? 1 : 3);
+}
+
+size_t Decoder::decode(const unsigned char* data, size_t size, unsigned char* pixels, size_t capacity,
+                       int scale) {
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+        return 0;
+    StageClock clock(times);
+    int offset = readHeader(data, size, header);
+    if (offset <= 0 || decodedSize(header, scale) > capacity)
+        return 0;
+    data += offset;
+    size -= offset;
+
+    const Sampling sampling = header.sampling;
+    const bool gray = sampling == GRAY;
+    const int channels = gray ? 1 : 3;
+    const int pwidth = paddedSize(header.width, gray);
+    const int pheight = paddedSize(header.height, gray);
+    const int mcuRows = pheight / (gray ? 8 : 16);
+    const int QF = qualityScale(header.quality);
+    const int swidth = pwidth / scale, sheight = pheight / scale;
+    const int outWidth = (header.width + scale - 1) / scale;
+    const int outHeight = (header.height + scale - 1) / scale;
+    const EntropyTables& tables = codingTables(header, custom);
+
+    // Restart slices are independent: each step runs on all of them in parallel
+    const int nslices = sliceCount(pheight, gray, header.restart);
+    const int rows = header.restart ? header.restart : mcuRows;   // MCU rows per slice
+    fitCoefs(coef, pheight, pwidth, sampling);
+    atomic<bool> ok(true);
+    if (header.restart == 0) {
+        ok = ACDCdecode(data, size, coef, pheight, sampling, tables);
+    } else {
+        if (header.sliceOffsets.back() > size)
+            return 0;
+        forSlices(pool, threads, nslices, [&](int s) {
+            size_t begin = header.sliceOffsets[s];
+            size_t end = (s + 1 < nslices) ? header.sliceOffsets[s + 1] : size;
+            if (!ACDCdecodeSlice(data + begin, end - begin, coef, pheight, pwidth, sampling, s * rows,
+                                 min(mcuRows, (s + 1) * rows), tables))
+                ok = false;
+        });
+    }
+    if (!ok)
+        return 0;
+    clock.lap(&StageTimes::entropy);
+
+    frame.resize(frameSamples(sheight, swidth, sampling));
+    forSlices(pool, threads, nslices, [&](int s) {
+        iquantDct2Rows(coef, frame, QF, pheight, pwidth, sampling, s * rows, min(mcuRows, (s + 1) * rows), scale);
+    });
+    clock.lap(&StageTimes::dct);
+
+    // Write out the image rows without the MCU padding
+    const size_t row = size_t(outWidth) * channels;
+    if (gray) {
+        for (int y = 0; y < outHeight; ++y)
+            memcpy(pixels + y * row, &frame[size_t(y) * swidth], row);
+    } else {
+        YUV2RGB(frame.data(), swidth, sheight, sampling, pixels, outWidth, outHeight);
+    }
+    clock.lap(&StageTimes::color);
+    return row * outHeight;
+}
\ No newline at end of file
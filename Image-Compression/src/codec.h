@@ -0,0 +1,82 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "myimage.h"
+
+// In-memory codec for programs that link the library (src/*.cpp) instead of
+// running encode / decode. An Encoder or Decoder reads and writes caller-owned
+// pixel and byte buffers and does no file I/O. It keeps its frame, coefficient
+// and bitstream buffers from one call to the next, so after the first image of
+// a given size, coding more images of that size allocates nothing (except the
+// table building of `optimize`, of rANS and of files with their own tables or
+// a block index). Use one object per thread; setSimd() and setFixedPoint() apply to
+// the whole process.
+
+// Milliseconds spent in each stage of an encode or decode. The codec adds to
+// color, dct and entropy; io and total are left to the caller, which does
+// the file reads and writes.
+struct StageTimes {
+    double io = 0;        // Reading and writing files
+    double color = 0;     // Edge padding/cropping and color conversion
+    double dct = 0;       // (I)DCT and (de)quantization
+    double entropy = 0;   // Entropy coding, including the statistics pass of optimize and rANS
+    double total = 0;
+};
+
+class Encoder {
+public:
+    int quality = 50;        // Quality Factor 1-100
+    bool optimize = false;   // Two-pass encode with optimized Huffman tables
+    EntropyCoder coder = HUFFMAN;   // Huffman or rANS (always two-pass)
+    int restart = 0;         // MCU rows per restart slice, 0 for none (at most the image's MCU rows)
+    int threads = 1;         // Threads coding the restart slices (0: all cores)
+    StageTimes* times = nullptr;    // If set, the time of each stage is added to it
+
+    // Compress a width x height image, RGB interleaved (or one byte per pixel
+    // with GRAY) and coded with chroma `sampling`, into `out`. Returns the size of the compressed file; when
+    // it is larger than `capacity`, nothing is written and the call can be
+    // repeated with a large enough buffer. Returns 0 for an invalid size (see validImageSize).
+    size_t encode(const unsigned char* pixels, int width, int height, Sampling sampling,
+                  unsigned char* out, size_t capacity);
+
+private:
+    ImageHeader header;
+    vector<unsigned char> padded;   // Pixels padded to whole MCUs
+    vector<unsigned char> frame;    // Gray or YUV frame
+    SparseCoefs coef;
+    EntropyTables custom;           // Optimized tables
+    vector<unsigned char> head;     // File header
+    vector<unsigned char> bits;     // Bitstream
+    vector<vector<unsigned char>> slices;   // Bitstream of each restart slice
+    unique_ptr<ThreadPool> pool;    // Slice workers, when threads != 1
+};
+
+class Decoder {
+public:
+    int threads = 1;         // Threads decoding the restart slices (0: all cores)
+    StageTimes* times = nullptr;    // If set, the time of each stage is added to it
+
+    // Parse the header of the compressed file `data` into `info` (image size,
+    // color mode, quality). Returns false for an invalid file; headerless
+    // legacy streams are not supported.
+    bool readInfo(const unsigned char* data, size_t size, ImageHeader& info);
+
+    // Size in bytes of the image decode() writes at `scale`
+    static size_t decodedSize(const ImageHeader& info, int scale = 1);
+
+    // Decompress `data` into `pixels`: ceil(width / scale) x ceil(height / scale)
+    // pixels, RGB interleaved or gray, with scale 1, 2, 4 or 8. Returns the
+    // number of bytes written, or 0 if the file is invalid or corrupt or
+    // `capacity` is smaller than decodedSize().
+    size_t decode(const unsigned char* data, size_t size, unsigned char* pixels, size_t capacity,
+                  int scale = 1);
+
+private:
+    ImageHeader header;
+    SparseCoefs coef;
+    vector<unsigned char> frame;    // Gray or YUV frame
+    EntropyTables custom;           // Tables stored in the file
+    unique_ptr<ThreadPool> pool;    // Slice workers, when threads != 1
+};
+
+#endif
\ No newline at end of file
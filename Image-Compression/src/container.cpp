@@ -0,0 +1,501 @@
+#include "myimage.h"
+
+// Compressed file layout (all integers little-endian):
+//   bytes 0-3   magic "JPGL"
+//   byte  4     format version, 1
+//   byte  5     flags (bit 0: grayscale, bit 1: Huffman tables stored in the file,
+//               bit 2: block index, bits 3-4: chroma subsampling of a color
+//               image, 0 for 4:2:0, 1 for 4:2:2, 2 for 4:4:4, bit 5: rANS-coded
+//               bitstream; the other bits are 0)
+//   byte  6     quality factor (1-100) given to the encoder
+//   byte  7     reserved, 0
+//   bytes 8-11  image width
+//   bytes 12-15 image height
+//   bytes 16-19 restart interval in MCU rows (0: one unsliced bitstream)
+// then the optional sections, in this order:
+//   if the restart interval is nonzero:
+//     4 bytes     slice count N
+//     N x 4 bytes byte offset of each slice from the start of the bitstream
+//   if flag bit 1 is set:
+//     the luminance DC and AC tables, then (color only) the chrominance DC
+//     and AC tables, each as 16 code-length counts followed by the symbols
+//   if flag bit 5 is set (never together with bit 2):
+//     the rANS frequencies of every context: luminance DC, chrominance DC,
+//     the luminance AC bands, then the chrominance AC bands (color only),
+//     each as a symbol count N (1 byte) and N x 3 bytes, a symbol and its
+//     frequency (2 bytes); the frequencies of a context add up to 4096
+//   if flag bit 2 is set:
+//     4 bytes     index interval N in blocks
+//     for every block row (the luminance rows, then the rows of the stacked
+//     U/V plane), one 7-byte entry per N blocks: the byte offset (4 bytes)
+//     and bit (1 byte) in the bitstream where the block's codes start, and
+//     the signed DC value the block is predicted from (2 bytes)
+// followed by the entropy-coded bitstream. A rANS bitstream, and each of its
+// slices, starts with the final values of the rANS states (4 bytes each).
+// Files without the magic are the original headerless 512x512 streams.
+
+static const unsigned char MAGIC[4] = {'J', 'P', 'G', 'L'};
+static const int VERSION = 1;
+static const int HEADER_SIZE = 20;   // The fixed fields
+static const int FLAGS = 63;         // Flag bits in use
+
+static void putU32(unsigned char* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+static uint32_t getU32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+static const int INDEX_ENTRY_SIZE = 7;
+
+// Number of block index entries of an image
+static uint64_t indexEntries(int width, int height, Sampling s, int interval) {
+    int pwidth = paddedSize(width, s == GRAY), pheight = paddedSize(height, s == GRAY);
+    uint64_t count = uint64_t(pheight / 8) * ((pwidth / 8 + interval - 1) / interval);
+    if (s != GRAY)
+        count += uint64_t(2 * chromaHeight(pheight, s) / 8) * ((chromaWidth(pwidth, s) / 8 + interval - 1) / interval);
+    return count;
+}
+
+// Convert Quality Factor (1-100) to quantization scale (JPEG standard approximation)
+int qualityScale(int QF) {
+    QF = clamp(QF, 1, 100);
+    if (QF < 50)
+        return 5000 / QF;
+    else
+        return 200 - 2 * QF;
+}
+
+// Dimensions rounded up to whole MCUs: 16x16 for color (any subsampling), 8x8 for gray
+int paddedSize(int size, bool gray) {
+    int mcu = gray ? 8 : 16;
+    return (size + mcu - 1) / mcu * mcu;
+}
+
+// Whether a width x height image is within the supported size: at most
+// 65535 pixels a side, as in JPEG, and a padded frame of at most 2^29
+// pixels, so that every sample offset of its YUV frame (up to 3 samples
+// per pixel) fits in an int
+bool validImageSize(int width, int height) {
+    if (width <= 0 || height <= 0 || width > 65535 || height > 65535)
+        return false;
+    return int64_t(paddedSize(width, false)) * paddedSize(height, false) <= (int64_t(1) << 29);
+}
+
+// Number of restart slices for a padded frame height
+int sliceCount(int height, bool gray, int restart) {
+    int rows = height / (gray ? 8 : 16);
+    return restart > 0 ? rows / restart + (rows % restart != 0) : 1;
+}
+
+// Block rows of each component plane covered by MCU rows [mcu0, mcu1) of a
+// padded frame. Color frames keep U and V stacked in one plane after Y, so
+// a slice covers one Y range and two chroma ranges.
+SlicePlanes sliceRows(int height, int width, Sampling s, int mcu0, int mcu1) {
+    SlicePlanes rows;
+    if (s == GRAY) {
+        rows.planes[rows.count++] = {0, width, mcu0, mcu1, false};
+    } else {
+        int framesize = height * width;
+        int cwidth = chromaWidth(width, s);
+        int chromaRows = chromaHeight(height, s) / 8;  // Block rows of the U (or V) plane
+        int perMcu = chromaHeight(16, s) / 8;          // Chroma block rows per MCU row
+        rows.planes[rows.count++] = {0, width, 2 * mcu0, 2 * mcu1, false};
+        rows.planes[rows.count++] = {framesize, cwidth, perMcu * mcu0, perMcu * mcu1, true};
+        rows.planes[rows.count++] = {framesize, cwidth, chromaRows + perMcu * mcu0, chromaRows + perMcu * mcu1, true};
+    }
+    return rows;
+}
+
+// Number of samples in a padded frame (Y, then U and V)
+size_t frameSamples(int height, int width, Sampling s) {
+    size_t luma = size_t(width) * height;
+    return s == GRAY ? luma : luma + 2 * size_t(chromaWidth(width, s)) * chromaHeight(height, s);
+}
+
+// Block index for a padded frame with one (empty) entry per `interval`
+// blocks of every block row, to be filled in by DCAC / DCACslice
+BlockIndex blockIndex(int interval, int height, int width, Sampling s) {
+    BlockIndex index;
+    index.interval = interval;
+    if (interval <= 0)
+        return index;
+    const int lumaRows = height / 8;
+    index.rows.resize(lumaRows + (s == GRAY ? 0 : 2 * chromaHeight(height, s) / 8));
+    for (size_t r = 0; r < index.rows.size(); ++r) {
+        int blocks = static_cast<int>(r) < lumaRows ? width / 8 : chromaWidth(width, s) / 8;
+        index.rows[r].resize((blocks + interval - 1) / interval);
+    }
+    return index;
+}
+
+// Move the index entries of MCU rows [mcu0, mcu1) by `bits`, from offsets
+// within a restart slice to offsets within the bitstream
+void shiftIndex(BlockIndex& index, int height, int width, Sampling s, int mcu0, int mcu1, uint64_t bits) {
+    for (const PlaneRows& p : sliceRows(height, width, s, mcu0, mcu1))
+        for (int by = p.row0; by < p.row1; ++by)
+            for (IndexEntry& e : index.rows[(p.chroma ? height / 8 : 0) + by])
+                e.bit += bits;
+}
+
+// Append the header to `ext`
+void writeHeader(vector<unsigned char>& ext, const ImageHeader& hdr) {
+    size_t start = ext.size();
+    ext.resize(start + HEADER_SIZE);
+    unsigned char* buf = &ext[start];
+    memset(buf, 0, HEADER_SIZE);
+    memcpy(buf, MAGIC, 4);
+    buf[4] = VERSION;
+    buf[5] = (hdr.gray() ? 1 : 0) | (hdr.customTables ? 2 : 0) | (hdr.index.interval > 0 ? 4 : 0) |
+             (hdr.gray() ? 0 : (hdr.sampling - YUV420) << 3) | (hdr.coder == RANS ? 32 : 0);
+    buf[6] = static_cast<unsigned char>(hdr.quality);
+    putU32(buf + 8, hdr.width);
+    putU32(buf + 12, hdr.height);
+    putU32(buf + 16, hdr.restart);
+    if (hdr.restart > 0) {
+        size_t pos = ext.size();
+        ext.resize(pos + 4 + 4 * hdr.sliceOffsets.size());
+        putU32(&ext[pos], static_cast<uint32_t>(hdr.sliceOffsets.size()));
+        for (size_t i = 0; i < hdr.sliceOffsets.size(); ++i)
+            putU32(&ext[pos + 4 + 4 * i], hdr.sliceOffsets[i]);
+    }
+    if (hdr.customTables) {
+        for (int t = 0; t < (hdr.gray() ? 2 : 4); ++t) {
+            ext.insert(ext.end(), hdr.huffman[t].bits + 1, hdr.huffman[t].bits + 17);
+            ext.insert(ext.end(), hdr.huffman[t].vals.begin(), hdr.huffman[t].vals.end());
+        }
+    }
+    if (hdr.coder == RANS) {
+        for (int c = 0; c < RANS_CONTEXTS; ++c) {
+            if (hdr.gray() && chromaContext(c))
+                continue;
+            const vector<uint16_t>& freq = hdr.rans.freq[c];
+            ext.push_back(static_cast<unsigned char>(freq.size() - count(freq.begin(), freq.end(), 0)));
+            for (size_t s = 0; s < freq.size(); ++s) {
+                if (freq[s] == 0) continue;
+                ext.push_back(static_cast<unsigned char>(s));
+                ext.push_back(static_cast<unsigned char>(freq[s]));
+                ext.push_back(static_cast<unsigned char>(freq[s] >> 8));
+            }
+        }
+    }
+    if (hdr.index.interval > 0) {
+        size_t pos = ext.size();
+        ext.resize(pos + 4);
+        putU32(&ext[pos], hdr.index.interval);
+        for (const vector<IndexEntry>& row : hdr.index.rows) {
+            for (const IndexEntry& e : row) {
+                pos = ext.size();
+                ext.resize(pos + INDEX_ENTRY_SIZE);
+                putU32(&ext[pos], static_cast<uint32_t>(e.bit / 8));
+                ext[pos + 4] = static_cast<unsigned char>(e.bit % 8);
+                ext[pos + 5] = static_cast<unsigned char>(e.pred);
+                ext[pos + 6] = static_cast<unsigned char>(e.pred >> 8);
+            }
+        }
+    }
+}
+
+bool writeHeader(ostream& os, const ImageHeader& hdr) {
+    vector<unsigned char> buf;
+    writeHeader(buf, hdr);
+    os.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+    return static_cast<bool>(os);
+}
+
+// Write the compressed file of the quantized frame `coef`: the header, then
+// the bitstream as one stream, or as slices of `restart` MCU rows coded in
+// parallel on `pool` into the `slices` buffers (reused from call to call).
+// With `optimize`, the symbol statistics are gathered first and optimized
+// tables stored in the header. A block index requested in the header is
+// filled in as the blocks are coded. Shared by encode.cpp and the quality
+// ladder.
+bool writeCodedFile(const string& file, ImageHeader header, const SparseCoefs& coef, int restart, bool optimize,
+                    ThreadPool& pool, vector<vector<unsigned char>>& slices) {
+    const Sampling sampling = header.sampling;
+    const bool gray = sampling == GRAY;
+    const int pwidth = paddedSize(header.width, gray);
+    const int pheight = paddedSize(header.height, gray);
+    const int mcuRows = pheight / (gray ? 8 : 16);
+    const int nslices = sliceCount(pheight, gray, restart);
+    BlockIndex* blockIdx = header.index.interval > 0 ? &header.index : nullptr;
+
+    ofstream fout(file, ios::binary);
+    if (!fout) {
+        cerr << "Cannot open output file " << file << endl;
+        return false;
+    }
+
+    // Two-pass mode: gather symbol statistics and build optimized tables
+    if (optimize) {
+        SymbolStats stats;
+        if (restart == 0) {
+            DCAC(coef, pheight, sampling, stats);
+        } else {
+            vector<SymbolStats> sliceStats(nslices);
+            pool.parallelFor(nslices, [&](int s) {
+                DCACslice(coef, pheight, pwidth, sampling, s * restart, min(mcuRows, (s + 1) * restart),
+                          sliceStats[s]);
+            });
+            for (const SymbolStats& st : sliceStats)
+                stats.add(st);
+        }
+        optimizeTables(header, stats);
+    }
+    EntropyTables tables = headerTables(header);
+
+    if (restart == 0) {
+        writeHeader(fout, header);
+        BitWriter bw(fout);
+        DCAC(coef, pheight, sampling, tables, bw, blockIdx);
+        bw.flush();
+
+        // The block index is only known now: rewrite the header (same size)
+        if (blockIdx) {
+            fout.seekp(0);
+            writeHeader(fout, header);
+        }
+    } else {
+        // The header needs the slice offsets: code the slices first
+        slices.resize(nslices);
+        pool.parallelFor(nslices, [&](int s) {
+            slices[s].clear();   // The bit writers append
+            BitWriter bw(slices[s]);
+            DCACslice(coef, pheight, pwidth, sampling, s * restart, min(mcuRows, (s + 1) * restart), tables, bw,
+                      blockIdx);
+        });
+
+        // Header with the slice offset index, then the slices back to back
+        header.restart = restart;
+        uint32_t offset = 0;
+        for (int s = 0; s < nslices; ++s) {
+            header.sliceOffsets.push_back(offset);
+            if (blockIdx)
+                shiftIndex(header.index, pheight, pwidth, sampling, s * restart, min(mcuRows, (s + 1) * restart),
+                           uint64_t(offset) * 8);
+            offset += slices[s].size();
+        }
+        writeHeader(fout, header);
+        for (int s = 0; s < nslices; ++s)
+            fout.write(reinterpret_cast<const char*>(slices[s].data()), slices[s].size());
+    }
+    fout.close();
+    if (!fout) {
+        cerr << "Cannot write output file " << file << endl;
+        return false;
+    }
+    return true;
+}
+
+// Parse the header at the start of `data`. Returns the header size in bytes,
+// 0 if the data has no header (legacy stream), or -1 if the header is invalid.
+// Slice offsets are checked for ordering only; callers check them against
+// the actual bitstream size.
+int readHeader(const unsigned char* data, size_t dataSize, ImageHeader& hdr) {
+    if (dataSize < 4 || memcmp(data, MAGIC, 4) != 0)
+        return 0;
+    if (dataSize < HEADER_SIZE) {
+        cerr << "Truncated file header.\n";
+        return -1;
+    }
+    if (data[4] != VERSION) {
+        cerr << "Unsupported file version " << int(data[4]) << ".\n";
+        return -1;
+    }
+
+    const int sampling = (data[5] >> 3) & 3;
+    if ((data[5] & ~FLAGS) || sampling > 2 ||
+        ((data[5] & 1) && sampling) || ((data[5] & 32) && (data[5] & 4))) {
+        cerr << "Unsupported file flags.\n";
+        return -1;
+    }
+    hdr.sampling = (data[5] & 1) ? GRAY : static_cast<Sampling>(YUV420 + sampling);
+    hdr.customTables = data[5] & 2;
+    hdr.coder = (data[5] & 32) ? RANS : HUFFMAN;
+    hdr.quality = data[6];
+    hdr.width = static_cast<int>(getU32(&data[8]));
+    hdr.height = static_cast<int>(getU32(&data[12]));
+    if (!validImageSize(hdr.width, hdr.height) || hdr.quality < 1 || hdr.quality > 100) {
+        cerr << "Invalid file header.\n";
+        return -1;
+    }
+
+    hdr.restart = static_cast<int>(getU32(&data[16]));
+    if (hdr.restart < 0 || hdr.restart > paddedSize(hdr.height, hdr.gray()) / (hdr.gray() ? 8 : 16)) {
+        cerr << "Invalid restart interval.\n";
+        return -1;
+    }
+
+    size_t size = HEADER_SIZE;
+    hdr.sliceOffsets.clear();
+    if (hdr.restart > 0) {
+        uint32_t count = dataSize >= size + 4 ? getU32(&data[size]) : 0;
+        int expected = sliceCount(paddedSize(hdr.height, hdr.gray()), hdr.gray(), hdr.restart);
+        if (count != static_cast<uint32_t>(expected) || dataSize < size + 4 + 4 * size_t(count)) {
+            cerr << "Invalid slice table.\n";
+            return -1;
+        }
+        size += 4;
+        for (uint32_t i = 0; i < count; ++i, size += 4) {
+            hdr.sliceOffsets.push_back(getU32(&data[size]));
+            if (i > 0 && hdr.sliceOffsets[i] < hdr.sliceOffsets[i - 1]) {
+                cerr << "Invalid slice table.\n";
+                return -1;
+            }
+        }
+    }
+
+    if (hdr.customTables) {
+        for (int t = 0; t < (hdr.gray() ? 2 : 4); ++t) {
+            HuffmanSpec& spec = hdr.huffman[t];
+            if (dataSize < size + 16) {
+                cerr << "Truncated Huffman table.\n";
+                return -1;
+            }
+            size_t count = 0;
+            for (int len = 1; len <= 16; ++len)
+                count += spec.bits[len] = data[size++];
+            if (dataSize < size + count) {
+                cerr << "Truncated Huffman table.\n";
+                return -1;
+            }
+            spec.vals.assign(data + size, data + size + count);
+            size += count;
+
+            HuffCode codes[AC_SYMBOLS];
+            if (!huffmanCodes(spec, codes, (t % 2) ? AC_SYMBOLS : DC_SYMBOLS)) {
+                cerr << "Invalid Huffman table.\n";
+                return -1;
+            }
+        }
+    }
+
+    hdr.rans = RansSpec();
+    if (hdr.coder == RANS) {
+        for (int c = 0; c < RANS_CONTEXTS; ++c) {
+            if (hdr.gray() && chromaContext(c))
+                continue;
+            const size_t count = dataSize > size ? data[size] : 0;
+            if (dataSize < size + 1 + 3 * count) {
+                cerr << "Truncated rANS table.\n";
+                return -1;
+            }
+            vector<uint16_t>& freq = hdr.rans.freq[c];
+            if (count > 0)
+                freq.assign(contextSymbols(c), 0);
+            bool ok = true;
+            for (size_t i = 0, p = size + 1; i < count; ++i, p += 3) {
+                ok &= data[p] < freq.size() && freq[data[p]] == 0;
+                if (ok) freq[data[p]] = static_cast<uint16_t>(data[p + 1] | (data[p + 2] << 8));
+            }
+            if (!ok || !validRansContext(freq, c)) {
+                cerr << "Invalid rANS table.\n";
+                return -1;
+            }
+            size += 1 + 3 * count;
+        }
+    }
+
+    hdr.index = BlockIndex();
+    if (data[5] & 4) {
+        int interval = dataSize >= size + 4 ? static_cast<int>(getU32(&data[size])) : 0;
+        if (interval <= 0 || interval > paddedSize(hdr.width, hdr.gray()) / 8 ||
+            dataSize < size + 4 + INDEX_ENTRY_SIZE * indexEntries(hdr.width, hdr.height, hdr.sampling, interval)) {
+            cerr << "Invalid block index.\n";
+            return -1;
+        }
+        size += 4;
+        hdr.index = blockIndex(interval, paddedSize(hdr.height, hdr.gray()), paddedSize(hdr.width, hdr.gray()),
+                               hdr.sampling);
+        for (vector<IndexEntry>& row : hdr.index.rows) {
+            for (IndexEntry& e : row) {
+                e.bit = uint64_t(getU32(&data[size])) * 8 + data[size + 4];
+                e.pred = static_cast<int16_t>(data[size + 5] | (data[size + 6] << 8));
+                size += INDEX_ENTRY_SIZE;
+            }
+        }
+    }
+    return static_cast<int>(size);
+}
+
+// Read just the header from the start of a stream, leaving the stream
+// positioned at the bitstream. Same return values as above.
+int readHeader(istream& is, ImageHeader& hdr) {
+    vector<unsigned char> buf(HEADER_SIZE);
+    is.read(reinterpret_cast<char*>(buf.data()), HEADER_SIZE);
+    buf.resize(is.gcount());
+    if (buf.size() < 4 || memcmp(buf.data(), MAGIC, 4) != 0)
+        return 0;
+
+    // Pull in the optional parts the fixed fields announce
+    auto more = [&](size_t n) {
+        size_t old = buf.size();
+        buf.resize(old + n);
+        is.read(reinterpret_cast<char*>(&buf[old]), n);
+        buf.resize(old + is.gcount());
+    };
+    if (buf.size() == HEADER_SIZE && getU32(&buf[16]) > 0) {
+        more(4);
+        if (buf.size() == HEADER_SIZE + 4)
+            more(4 * size_t(min<uint32_t>(getU32(&buf[HEADER_SIZE]), 1u << 24)));
+    }
+    if (buf.size() >= HEADER_SIZE && (buf[5] & 2)) {
+        for (int t = 0; t < ((buf[5] & 1) ? 2 : 4); ++t) {
+            size_t start = buf.size();
+            more(16);
+            if (buf.size() < start + 16) break;
+            size_t count = 0;
+            for (size_t i = start; i < start + 16; ++i) count += buf[i];
+            more(count);
+        }
+    }
+    if (buf.size() >= HEADER_SIZE && (buf[5] & 32)) {
+        for (int c = 0; c < RANS_CONTEXTS; ++c) {
+            if ((buf[5] & 1) && chromaContext(c))
+                continue;
+            size_t start = buf.size();
+            more(1);
+            if (buf.size() < start + 1) break;
+            more(3 * size_t(buf[start]));
+        }
+    }
+    if (buf.size() >= HEADER_SIZE && (buf[5] & 4)) {
+        size_t start = buf.size();
+        more(4);
+        int interval = buf.size() == start + 4 ? static_cast<int>(getU32(&buf[start])) : 0;
+        int width = static_cast<int>(getU32(&buf[8])), height = static_cast<int>(getU32(&buf[12]));
+        Sampling sampling = (buf[5] & 1) ? GRAY : static_cast<Sampling>(YUV420 + min((buf[5] >> 3) & 3, 2));
+        if (interval > 0 && width > 0 && height > 0)
+            more(INDEX_ENTRY_SIZE * min<uint64_t>(indexEntries(width, height, sampling, interval), 1u << 24));
+    }
+    return readHeader(buf.data(), buf.size(), hdr);
+}
+
+// Copy a width x height image with `channels` interleaved samples per pixel
+// into a pwidth x pheight frame, replicating the last column and row.
+void padFrame(const unsigned char* img, int width, int height, int channels, int pwidth, int pheight,
+              unsigned char* out) {
+    for (int y = 0; y < pheight; ++y) {
+        const unsigned char* src = &img[static_cast<size_t>(min(y, height - 1)) * width * channels];
+        unsigned char* dst = &out[static_cast<size_t>(y) * pwidth * channels];
+        memcpy(dst, src, static_cast<size_t>(width) * channels);
+        for (int x = width; x < pwidth; ++x)
+            memcpy(dst + x * channels, src + (width - 1) * channels, channels);
+    }
+}
+
+vector<unsigned char> padFrame(const vector<unsigned char>& img, int width, int height,
+                               int channels, int pwidth, int pheight) {
+    vector<unsigned char> out(static_cast<size_t>(pwidth) * pheight * channels);
+    padFrame(img.data(), width, height, channels, pwidth, pheight, out.data());
+    return out;
+}
+
+// Cut the top-left width x height region out of a padded frame (in place)
+void cropFrame(vector<unsigned char>& img, int width, int height, int channels, int pwidth) {
+    size_t row = static_cast<size_t>(width) * channels;
+    for (int y = 0; y < height; ++y)
+        memmove(&img[y * row], &img[static_cast<size_t>(y) * pwidth * channels], row);
+    img.resize(row * height);
+}
\ No newline at end of file
@@ -8,8 +8,6 @@ The array size is n*n where n must be an integer power of 2. */
 
 #include "myimage.h"
 
-void dct1(float *x, int n);
-void idct1(float *x, int n);
 
 void dct2(float **x, int n)
 {
@@ -95,133 +93,236 @@ const int chrominanceQuantMatrix[8][8] = {
     {99, 99, 99, 99, 99, 99, 99, 99}
 };
 
-vector<int> quantDct2(vector<unsigned char>& img, int QF, int height, int width, bool gray = false) {
-    int framesize = width * height;
-
-    vector<int> imgOut;
-    if (gray)
-        imgOut.resize(framesize);       // Only luminance (Y) component
-    else
-        imgOut.resize(framesize * 3 / 2); // Y + subsampled U + V components (YUV 4:2:0 layout)
-
-    // Allocate an 8x8 block for DCT input
-    float** arr = (float**)malloc(8 * sizeof(float*));
-    for (int i = 0; i < 8; ++i)
-        arr[i] = (float*)malloc(8 * sizeof(float));
-
-    // Process the luminance (Y) channel in 8x8 blocks
-    for (int y = 0; y < height; y += 8) {
-        for (int x = 0; x < width; x += 8) {
-            int idx = y * width + x;
-
-            // Copy and level-shift the 8x8 block from the image
-            for (int i = 0; i < 8; ++i)
-                for (int j = 0; j < 8; ++j)
-                    arr[i][j] = static_cast<float>(img[idx + i * width + j] - 128);  // Center range to [-128,127]
-
-            dct2(arr, 8); // Perform 2D DCT on the block
-
-            // Quantize the DCT coefficients using the luminance quantization matrix
-            for (int i = 0; i < 8; ++i)
-                for (int j = 0; j < 8; ++j)
-                    imgOut[idx + i * width + j] =
-                        static_cast<int>(round(arr[i][j] / luminanceQuantMatrix[i][j] * QF / 100.0));
-        }
+// Store the DC of a raster 8x8 block in `dc` and append its AC coefficients
+// to `ac` in zigzag order, as (run, level) pairs plus the end-of-block
+// marker. Levels are clipped to +-MAX_LEVEL, the range of the entropy
+// coders. Branch-free: every position writes a candidate pair, and only
+// nonzero ones advance the count.
+static void packBlock(const int* blk, int16_t& dc, vector<RunLevel>& ac) {
+    dc = static_cast<int16_t>(clamp(blk[0], -MAX_LEVEL, MAX_LEVEL));
+    RunLevel pairs[64];
+    int n = 0, run = 0;
+    for (int i = 1; i < 64; ++i) {
+        int v = clamp(blk[zigzagPos[i]], -MAX_LEVEL, MAX_LEVEL);
+        pairs[n] = {static_cast<uint8_t>(run), static_cast<int16_t>(v)};
+        n += (v != 0);
+        run = (v != 0) ? 0 : run + 1;
     }
+    pairs[n++] = {0, 0};
+    ac.insert(ac.end(), pairs, pairs + n);
+}
 
-    if (!gray) {
-        // Process chrominance (U and V) channels in 8x8 blocks
-        for (int y = 0; y < height; y += 8) {
-            for (int x = 0; x < width / 2; x += 8) {
-                int idx = y * (width / 2) + x + framesize;  // Start index for U/V blocks
-
-                // Copy and level-shift the 8x8 block
-                for (int i = 0; i < 8; ++i)
-                    for (int j = 0; j < 8; ++j)
-                        arr[i][j] = static_cast<float>(img[idx + i * (width / 2) + j] - 128);
+// Expand the DC and the pairs of one block into a raster 8x8 block; returns
+// the pairs of the next block
+static const RunLevel* unpackBlock(const RunLevel* p, int dc, int* blk) {
+    memset(blk, 0, 64 * sizeof(int));
+    blk[0] = dc;
+    for (int k = 0; p->level != 0; ++p) {
+        k += p->run + 1;
+        blk[zigzagPos[k]] = p->level;
+    }
+    return p + 1;
+}
 
-                dct2(arr, 8); // Perform DCT
+// DCT and quantize MCU rows [mcu0, mcu1) of a YUV (or gray) frame into `out`
+void quantDct2Rows(const unsigned char* img, SparseCoefs& out, int QF, int height, int width,
+                   Sampling s, int mcu0, int mcu1) {
+    const bool fixed = fixedPointMode();
+
+    // Quantization tables with the DCT output scale folded in
+    float lumTab[64], chrTab[64];
+    int32_t lumTabInt[64], chrTabInt[64];
+    if (fixed) {
+        fdctQuantTableInt(luminanceQuantMatrix, QF, lumTabInt);
+        fdctQuantTableInt(chrominanceQuantMatrix, QF, chrTabInt);
+    } else {
+        fdctQuantTable(luminanceQuantMatrix, QF, lumTab);
+        fdctQuantTable(chrominanceQuantMatrix, QF, chrTab);
+    }
 
-                // Quantize using the chrominance quantization matrix
-                for (int i = 0; i < 8; ++i)
-                    for (int j = 0; j < 8; ++j)
-                        imgOut[idx + i * (width / 2) + j] =
-                            static_cast<int>(round(arr[i][j] / chrominanceQuantMatrix[i][j] * QF / 100.0));
+    // Process each component in 8x8 blocks:
+    // level shift to [-128,127], 2D DCT and quantization in one pass
+    for (const PlaneRows& p : sliceRows(height, width, s, mcu0, mcu1)) {
+        const float* tab = p.chroma ? chrTab : lumTab;
+        const int32_t* tabInt = p.chroma ? chrTabInt : lumTabInt;
+        for (int by = p.row0; by < p.row1; ++by) {
+            CoefRow& row = out.row(p.chroma, by);
+            row.ac.clear();
+            for (int bx = 0; bx < p.width / 8; ++bx) {
+                int blk[64];
+                int idx = p.offset + by * 8 * p.width + bx * 8;
+                if (fixed)
+                    fdctQuantBlockInt(&img[idx], p.width, tabInt, blk, 8);
+                else
+                    fdctQuantBlock(&img[idx], p.width, tab, blk, 8);
+                packBlock(blk, row.dc[bx], row.ac);
             }
         }
     }
+}
 
-    // Free dynamically allocated memory
-    for (int i = 0; i < 8; ++i)
-        free(arr[i]);
-    free(arr);
-
-    return imgOut;
+void quantDct2Rows(const vector<unsigned char>& img, SparseCoefs& out, int QF, int height, int width,
+                   Sampling s, int mcu0, int mcu1) {
+    quantDct2Rows(img.data(), out, QF, height, width, s, mcu0, mcu1);
 }
 
+// Give `coef` the block rows of a height x width frame, keeping its buffers
+// when it already has them. The coefficients are left as they were: every
+// quantizer and entropy decoder rewrites the rows it fills.
+void fitCoefs(SparseCoefs& coef, int height, int width, Sampling s) {
+    size_t rows = height / 8 + (s == GRAY ? 0 : 2 * chromaHeight(height, s) / 8);
+    size_t lastBlocks = (s == GRAY ? width : chromaWidth(width, s)) / 8;
+    if (coef.lumaRows == height / 8 && coef.rows.size() == rows && coef.rows[0].dc.size() == size_t(width / 8) &&
+        coef.rows.back().dc.size() == lastBlocks)
+        return;
+    coef = SparseCoefs(height, width, s);
+}
 
-/* ----------------------------------------------- */
+SparseCoefs quantDct2(vector<unsigned char>& img, int QF, int height, int width, Sampling s) {
+    SparseCoefs imgOut(height, width, s);  // Y (+ U and V) block rows
+    quantDct2Rows(img, imgOut, QF, height, width, s, 0, height / (s == GRAY ? 8 : 16));
+    return imgOut;
+}
 
-vector<unsigned char> iquantDct2(vector<int>& img, int QF, int height, int width, bool gray = false) {
-    int framesize = width * height;
 
-    vector<unsigned char> imgOut;
-    if (gray)
-        imgOut.resize(framesize);        // For grayscale: only Y channel
+// Level shift and DCT every block of a YUV (or gray) frame once, without
+// quantizing, for rate control trials at several QFs
+DctCache dctCache(const unsigned char* img, int height, int width, Sampling s) {
+    DctCache cache;
+    cache.height = height;
+    cache.width = width;
+    cache.sampling = s;
+    cache.fixed = fixedPointMode();
+    size_t samples = frameSamples(height, width, s);
+    if (cache.fixed)
+        cache.coefInt.resize(samples);
     else
-        imgOut.resize(framesize * 3 / 2); // For color: Y + subsampled U and V (YUV 4:2:0)
-
-    // Allocate an 8x8 block for inverse DCT
-    float** arr = (float**)malloc(8 * sizeof(float*));
-    for (int i = 0; i < 8; ++i)
-        arr[i] = (float*)malloc(8 * sizeof(float));
-
-    // Process the luminance (Y) channel in 8x8 blocks
-    for (int y = 0; y < height; y += 8) {
-        for (int x = 0; x < width; x += 8) {
-            int idx = y * width + x;
-
-            // Dequantize each coefficient by multiplying with quantization matrix
-            for (int i = 0; i < 8; ++i)
-                for (int j = 0; j < 8; ++j)
-                    arr[i][j] = static_cast<float>(
-                        img[idx + i * width + j] * luminanceQuantMatrix[i][j] * 100.0 / QF);
-
-            idct2(arr, 8); // Apply 2D inverse DCT
-
-            // Add 128 to shift back from [-128,127] to [0,255]
-            for (int i = 0; i < 8; ++i)
-                for (int j = 0; j < 8; ++j)
-                    imgOut[idx + i * width + j] = static_cast<unsigned char>(round(arr[i][j] + 128));
+        cache.coef.resize(samples);
+
+    size_t k = 0;   // Block number
+    for (const PlaneRows& p : sliceRows(height, width, s, 0, height / (s == GRAY ? 8 : 16))) {
+        for (int by = p.row0; by < p.row1; ++by) {
+            for (int bx = 0; bx < p.width / 8; ++bx, ++k) {
+                int idx = p.offset + by * 8 * p.width + bx * 8;
+                if (cache.fixed)
+                    fdctBlockInt(&img[idx], p.width, &cache.coefInt[k * 64]);
+                else
+                    fdctBlock(&img[idx], p.width, &cache.coef[k * 64]);
+            }
         }
     }
+    return cache;
+}
+
+DctCache dctCache(const vector<unsigned char>& img, int height, int width, Sampling s) {
+    return dctCache(img.data(), height, width, s);
+}
 
-    if (!gray) {
-        // Process chrominance (U and V) channels in 8x8 blocks
-        for (int y = 0; y < height; y += 8) {
-            for (int x = 0; x < width / 2; x += 8) {
-                int idx = y * (width / 2) + x + framesize;
+// Quantize a cached transform; the result is the same as quantDct2 on the frame
+SparseCoefs quantDctCache(const DctCache& cache, int QF) {
+    const int height = cache.height, width = cache.width;
+    const Sampling s = cache.sampling;
+
+    float lumTab[64], chrTab[64];
+    int32_t lumTabInt[64], chrTabInt[64];
+    if (cache.fixed) {
+        fdctQuantTableInt(luminanceQuantMatrix, QF, lumTabInt);
+        fdctQuantTableInt(chrominanceQuantMatrix, QF, chrTabInt);
+    } else {
+        fdctQuantTable(luminanceQuantMatrix, QF, lumTab);
+        fdctQuantTable(chrominanceQuantMatrix, QF, chrTab);
+    }
+
+    SparseCoefs out(height, width, s);
+    size_t k = 0;
+    for (const PlaneRows& p : sliceRows(height, width, s, 0, height / (s == GRAY ? 8 : 16))) {
+        const float* tab = p.chroma ? chrTab : lumTab;
+        const int32_t* tabInt = p.chroma ? chrTabInt : lumTabInt;
+        for (int by = p.row0; by < p.row1; ++by) {
+            CoefRow& row = out.row(p.chroma, by);
+            row.ac.clear();
+            for (int bx = 0; bx < p.width / 8; ++bx, ++k) {
+                int blk[64];
+                if (cache.fixed)
+                    quantBlockInt(&cache.coefInt[k * 64], tabInt, blk, 8);
+                else
+                    quantBlock(&cache.coef[k * 64], tab, blk, 8);
+                packBlock(blk, row.dc[bx], row.ac);
+            }
+        }
+    }
+    return out;
+}
 
-                // Dequantize using chrominance quantization matrix
-                for (int i = 0; i < 8; ++i)
-                    for (int j = 0; j < 8; ++j)
-                        arr[i][j] = static_cast<float>(
-                            img[idx + i * (width / 2) + j] * chrominanceQuantMatrix[i][j] * 100.0 / QF);
+/* ----------------------------------------------- */
 
-                idct2(arr, 8); // Apply 2D inverse DCT
+// Dequantize and inverse DCT MCU rows [mcu0, mcu1) of the coefficients into `out`.
+// With scale 2, 4 or 8, `out` is the frame scaled down by that factor (same
+// plane layout, width / scale x height / scale): each block is reconstructed
+// from its lowest 8 / scale frequencies only, by a reduced inverse transform.
+void iquantDct2Rows(const SparseCoefs& img, vector<unsigned char>& out, int QF, int height, int width,
+                    Sampling s, int mcu0, int mcu1, int scale) {
+    const bool fixed = fixedPointMode();
+    const int size = 8 / scale;   // Output block size
+
+    // Dequantization tables with the IDCT input scale folded in
+    float lumTab[64], chrTab[64];
+    int32_t lumTabInt[64], chrTabInt[64];
+    if (fixed) {
+        idctDequantTableInt(luminanceQuantMatrix, QF, lumTabInt);
+        idctDequantTableInt(chrominanceQuantMatrix, QF, chrTabInt);
+    } else if (size < 8) {
+        idctReducedTable(luminanceQuantMatrix, QF, lumTab);
+        idctReducedTable(chrominanceQuantMatrix, QF, chrTab);
+    } else {
+        idctDequantTable(luminanceQuantMatrix, QF, lumTab);
+        idctDequantTable(chrominanceQuantMatrix, QF, chrTab);
+    }
 
-                // Re-shift to [0,255] range
-                for (int i = 0; i < 8; ++i)
-                    for (int j = 0; j < 8; ++j)
-                        imgOut[idx + i * (width / 2) + j] = static_cast<unsigned char>(round(arr[i][j] + 128));
+    // Process each component in 8x8 blocks:
+    // dequantization, 2D inverse DCT, shift back to [0,255] and clamp.
+    // Blocks without AC coefficients take the DC-only shortcut.
+    for (PlaneRows p : sliceRows(height, width, s, mcu0, mcu1)) {
+        p.offset /= scale * scale;
+        p.width /= scale;
+        const float* tab = p.chroma ? chrTab : lumTab;
+        const int32_t* tabInt = p.chroma ? chrTabInt : lumTabInt;
+        for (int by = p.row0; by < p.row1; ++by) {
+            const CoefRow& row = img.row(p.chroma, by);
+            const RunLevel* ac = row.ac.data();
+            for (int bx = 0; bx < p.width / size; ++bx) {
+                unsigned char* dst = &out[p.offset + by * size * p.width + bx * size];
+                if (ac->level == 0 || size == 1) {
+                    while ((ac++)->level != 0) {}
+                    if (fixed)
+                        idctDequantDCInt(row.dc[bx], tabInt, size, dst, p.width);
+                    else
+                        idctDequantDC(row.dc[bx], tab, size, dst, p.width);
+                    continue;
+                }
+                int blk[64];
+                ac = unpackBlock(ac, row.dc[bx], blk);
+                if (size < 8) {
+                    if (fixed)
+                        idctDequantReducedInt(blk, 8, tabInt, size, dst, p.width);
+                    else
+                        idctDequantReduced(blk, 8, tab, size, dst, p.width);
+                } else if (fixed) {
+                    idctDequantBlockInt(blk, 8, tabInt, dst, p.width);
+                } else {
+                    idctDequantBlock(blk, 8, tab, dst, p.width);
+                }
             }
         }
     }
+}
 
-    // Free dynamically allocated memory
-    for (int i = 0; i < 8; ++i)
-        free(arr[i]);
-    free(arr);
+// Reconstruct the frame, scaled down by `scale` (1, 2, 4 or 8)
+vector<unsigned char> iquantDct2(const SparseCoefs& img, int QF, int height, int width, Sampling s,
+                                 int scale = 1) {
+    // Gray: only the Y channel; color: Y + U and V
+    vector<unsigned char> imgOut(frameSamples(height / scale, width / scale, s));
 
+    iquantDct2Rows(img, imgOut, QF, height, width, s, 0, height / (s == GRAY ? 8 : 16), scale);
     return imgOut;
-}
+}
\ No newline at end of file
@@ -0,0 +1,390 @@
+/* Fast 8x8 DCT (type II) program */
+/* This file contains two subprograms. The first one is "fdct8x8(x)",
+which performs the forward 2-D DCT of one 8x8 block, and the second one
+is "idct8x8(x)", which performs the inverse 2-D DCT. The block x is a
+row-major float[64] and is replaced in place by its transform.
+Both use the Arai-Agui-Nakajima (AAN) factorization: 5 multiplies and
+29 additions per 1-D pass, with the remaining per-coefficient scale
+folded into one 64-entry table. The results are orthonormal and match
+"dct2(x,8)" / "idct2(x,8)" up to float rounding; those generic-n routines
+are kept as the reference implementation.
+The codec itself calls the fused block kernels "fdctQuantBlock" and
+"idctDequantBlock" at the end of this file, which also fold the level
+shift and (de)quantization into the transform. They run on AVX2 when the
+CPU supports it (dct8avx2.cpp) and otherwise on the scalar code here; both
+perform the same float operations in the same order, so their results are
+bit-exact. */
+
+#include "myimage.h"
+
+/* Raster position (row*8 + column) of each zigzag scan index. The scan
+starts down the first column, i.e. it is the transpose of the JPEG scan. */
+const unsigned char zigzagPos[64] = {
+   0,  8,  1,  2,  9, 16, 24, 17, 10,  3,  4, 11, 18, 25, 32, 40,
+  33, 26, 19, 12,  5,  6, 13, 20, 27, 34, 41, 48, 56, 49, 42, 35,
+  28, 21, 14,  7, 15, 22, 29, 36, 43, 50, 57, 58, 51, 44, 37, 30,
+  23, 31, 38, 45, 52, 59, 60, 53, 46, 39, 47, 54, 61, 62, 55, 63
+};
+
+/* AAN scale factors: aan[0] = 1, aan[k] = cos(k*PI/16) * sqrt(2) */
+static const double aan[8] = {
+  1.0, 1.387039845, 1.306562965, 1.175875602,
+  1.0, 0.785694958, 0.541196100, 0.275899379
+};
+
+struct AanScale {
+  float fwd[64];   /* AAN output -> orthonormal coefficient */
+  float inv[64];   /* orthonormal coefficient -> AAN input (includes the 1/8 descale) */
+  AanScale() {
+    for (int u = 0; u < 8; u++)
+      for (int v = 0; v < 8; v++) {
+        fwd[u*8+v] = (float)(1.0 / (aan[u] * aan[v] * 8.0));
+        inv[u*8+v] = (float)(aan[u] * aan[v] / 8.0);
+      }
+  }
+};
+
+static const AanScale scale;
+
+/* One forward 1-D pass over 8 elements spaced "s" apart */
+static inline void fdct8(float *d, int s)
+{
+  float tmp0,tmp1,tmp2,tmp3,tmp4,tmp5,tmp6,tmp7;
+  float tmp10,tmp11,tmp12,tmp13;
+  float z1,z2,z3,z4,z5,z11,z13;
+
+  tmp0 = d[0*s] + d[7*s];
+  tmp7 = d[0*s] - d[7*s];
+  tmp1 = d[1*s] + d[6*s];
+  tmp6 = d[1*s] - d[6*s];
+  tmp2 = d[2*s] + d[5*s];
+  tmp5 = d[2*s] - d[5*s];
+  tmp3 = d[3*s] + d[4*s];
+  tmp4 = d[3*s] - d[4*s];
+
+  /* Even part */
+  tmp10 = tmp0 + tmp3;
+  tmp13 = tmp0 - tmp3;
+  tmp11 = tmp1 + tmp2;
+  tmp12 = tmp1 - tmp2;
+
+  d[0*s] = tmp10 + tmp11;
+  d[4*s] = tmp10 - tmp11;
+
+  z1 = (tmp12 + tmp13) * 0.707106781f;
+  d[2*s] = tmp13 + z1;
+  d[6*s] = tmp13 - z1;
+
+  /* Odd part */
+  tmp10 = tmp4 + tmp5;
+  tmp11 = tmp5 + tmp6;
+  tmp12 = tmp6 + tmp7;
+
+  z5 = (tmp10 - tmp12) * 0.382683433f;
+  z2 = 0.541196100f * tmp10 + z5;
+  z4 = 1.306562965f * tmp12 + z5;
+  z3 = tmp11 * 0.707106781f;
+
+  z11 = tmp7 + z3;
+  z13 = tmp7 - z3;
+
+  d[5*s] = z13 + z2;
+  d[3*s] = z13 - z2;
+  d[1*s] = z11 + z4;
+  d[7*s] = z11 - z4;
+}
+
+/* One inverse 1-D pass over 8 elements spaced "s" apart */
+static inline void idct8(float *d, int s)
+{
+  float tmp0,tmp1,tmp2,tmp3,tmp4,tmp5,tmp6,tmp7;
+  float tmp10,tmp11,tmp12,tmp13;
+  float z5,z10,z11,z12,z13;
+
+  /* Even part */
+  tmp0 = d[0*s];
+  tmp1 = d[2*s];
+  tmp2 = d[4*s];
+  tmp3 = d[6*s];
+
+  tmp10 = tmp0 + tmp2;
+  tmp11 = tmp0 - tmp2;
+
+  tmp13 = tmp1 + tmp3;
+  tmp12 = (tmp1 - tmp3) * 1.414213562f - tmp13;
+
+  tmp0 = tmp10 + tmp13;
+  tmp3 = tmp10 - tmp13;
+  tmp1 = tmp11 + tmp12;
+  tmp2 = tmp11 - tmp12;
+
+  /* Odd part */
+  tmp4 = d[1*s];
+  tmp5 = d[3*s];
+  tmp6 = d[5*s];
+  tmp7 = d[7*s];
+
+  z13 = tmp6 + tmp5;
+  z10 = tmp6 - tmp5;
+  z11 = tmp4 + tmp7;
+  z12 = tmp4 - tmp7;
+
+  tmp7 = z11 + z13;
+  tmp11 = (z11 - z13) * 1.414213562f;
+
+  z5 = (z10 + z12) * 1.847759065f;
+  tmp10 = 1.082392200f * z12 - z5;
+  tmp12 = -2.613125930f * z10 + z5;
+
+  tmp6 = tmp12 - tmp7;
+  tmp5 = tmp11 - tmp6;
+  tmp4 = tmp10 + tmp5;
+
+  d[0*s] = tmp0 + tmp7;
+  d[7*s] = tmp0 - tmp7;
+  d[1*s] = tmp1 + tmp6;
+  d[6*s] = tmp1 - tmp6;
+  d[2*s] = tmp2 + tmp5;
+  d[5*s] = tmp2 - tmp5;
+  d[4*s] = tmp3 + tmp4;
+  d[3*s] = tmp3 - tmp4;
+}
+
+/* ----------------------------------------------- */
+
+void fdct8x8(float *x)
+{
+  int i;
+
+  for (i=0;i<8;i++)
+    fdct8(x + i, 8);     /* columns */
+  for (i=0;i<8;i++)
+    fdct8(x + i*8, 1);   /* rows */
+
+  for (i=0;i<64;i++)
+    x[i] *= scale.fwd[i];
+}
+
+/* ----------------------------------------------- */
+
+void idct8x8(float *x)
+{
+  int i;
+
+  for (i=0;i<64;i++)
+    x[i] *= scale.inv[i];
+
+  for (i=0;i<8;i++)
+    idct8(x + i, 8);     /* columns */
+  for (i=0;i<8;i++)
+    idct8(x + i*8, 1);   /* rows */
+}
+
+/* ----------------------------------------------- */
+
+/* Quantization table for fdctQuantBlock: AAN output scale times QF/(100*q) */
+void fdctQuantTable(const int q[8][8], int QF, float *tab)
+{
+  for (int i = 0; i < 64; i++)
+    tab[i] = (float)(scale.fwd[i] * QF / (100.0 * q[i/8][i%8]));
+}
+
+/* Dequantization table for idctDequantBlock: q*100/QF times AAN input scale */
+void idctDequantTable(const int q[8][8], int QF, float *tab)
+{
+  for (int i = 0; i < 64; i++)
+    tab[i] = (float)(scale.inv[i] * q[i/8][i%8] * 100.0 / QF);
+}
+
+/* Level shift and forward DCT one 8x8 block of pixels into x, leaving the
+AAN output scale to the quantization table. Splitting fdctQuantBlock this
+way lets a transform be quantized at several QFs (quantBlock). */
+void fdctBlock(const unsigned char *src, int stride, float *x)
+{
+  int i,j;
+
+  for (i=0;i<8;i++)
+    for (j=0;j<8;j++)
+      x[i*8+j] = (float)(src[i*stride+j] - 128);
+
+  for (i=0;i<8;i++)
+    fdct8(x + i, 8);     /* columns */
+  for (i=0;i<8;i++)
+    fdct8(x + i*8, 1);   /* rows */
+}
+
+/* Quantize one block of fdctBlock output with a fdctQuantTable table */
+static void quantBlockC(const float *x, const float *tab, int *dst, int dstStride)
+{
+  int i,j;
+
+  for (i=0;i<8;i++)
+    for (j=0;j<8;j++)
+      dst[i*dstStride+j] = (int)lrintf(x[i*8+j] * tab[i*8+j]);
+}
+
+/* Level shift, forward DCT and quantize one 8x8 block of pixels */
+static void fdctQuantBlockC(const unsigned char *src, int stride, const float *tab, int *dst, int dstStride)
+{
+  float x[64];
+
+  fdctBlock(src, stride, x);
+  quantBlockC(x, tab, dst, dstStride);
+}
+
+/* Dequantize, inverse DCT, level shift and clamp one 8x8 block of coefficients */
+static void idctDequantBlockC(const int *src, int srcStride, const float *tab, unsigned char *dst, int stride)
+{
+  float x[64];
+  int i,j;
+
+  for (i=0;i<8;i++)
+    for (j=0;j<8;j++)
+      x[i*8+j] = (float)src[i*srcStride+j] * tab[i*8+j];
+
+  for (i=0;i<8;i++)
+    idct8(x + i, 8);     /* columns */
+  for (i=0;i<8;i++)
+    idct8(x + i*8, 1);   /* rows */
+
+  for (i=0;i<8;i++)
+    for (j=0;j<8;j++)
+      dst[i*stride+j] = (unsigned char)clamp((int)lrintf(x[i*8+j] + 128.0f), 0, 255);
+}
+
+/* Dequantize and inverse transform a block whose AC coefficients are all
+zero: every output of the size x size block is the DC term. Same float
+operations as the full kernels (the zero terms add nothing), so the results
+are identical. Also takes the idctReducedTable tables, whose DC entry is
+the same. */
+void idctDequantDC(int dc, const float *tab, int size, unsigned char *dst, int stride)
+{
+  unsigned char v = (unsigned char)clamp((int)lrintf((float)dc * tab[0] + 128.0f), 0, 255);
+  for (int i=0;i<size;i++)
+    memset(dst + i*stride, v, size);
+}
+
+/* ----------------------------------------------- */
+
+/* Dequantization table for idctDequantReduced: q*100/QF times the 1/8 of
+the 2-D transform */
+void idctReducedTable(const int q[8][8], int QF, float *tab)
+{
+  for (int i = 0; i < 64; i++)
+    tab[i] = (float)(q[i/8][i%8] * 100.0 / QF / 8.0);
+}
+
+/* One inverse 1-D pass of "size" (4, 2 or 1) points spaced "s" apart over
+the lowest "size" coefficients of an 8-point DCT. Uses the 8-point basis
+weights sampled on the coarser grid, so each output is close to the mean
+of the 8/size pixels it replaces. The 1/8 of the transform is in the
+table; the DC weight is 1 and the others are sqrt(2)*cos. */
+static inline void idctReduced(float *d, int s, int size)
+{
+  float tmp0,tmp1,tmp10,tmp11;
+
+  if (size == 4) {
+    tmp0 = d[0*s] + d[2*s];
+    tmp1 = d[0*s] - d[2*s];
+    tmp10 = d[1*s] * 1.306562965f + d[3*s] * 0.541196100f;
+    tmp11 = d[1*s] * 0.541196100f - d[3*s] * 1.306562965f;
+
+    d[0*s] = tmp0 + tmp10;
+    d[3*s] = tmp0 - tmp10;
+    d[1*s] = tmp1 + tmp11;
+    d[2*s] = tmp1 - tmp11;
+  } else if (size == 2) {
+    tmp0 = d[0*s];
+    d[0*s] = tmp0 + d[1*s];
+    d[1*s] = tmp0 - d[1*s];
+  }
+}
+
+/* Dequantize and inverse transform the top-left size x size coefficients
+of one 8x8 block into a size x size block of pixels, i.e. the block scaled
+down by 8/size. Level shift and clamp as in idctDequantBlock. */
+void idctDequantReduced(const int *src, int srcStride, const float *tab, int size, unsigned char *dst, int stride)
+{
+  float x[16];
+  int i,j;
+
+  for (i=0;i<size;i++)
+    for (j=0;j<size;j++)
+      x[i*size+j] = (float)src[i*srcStride+j] * tab[i*8+j];
+
+  for (i=0;i<size;i++)
+    idctReduced(x + i, size, size);      /* columns */
+  for (i=0;i<size;i++)
+    idctReduced(x + i*size, 1, size);    /* rows */
+
+  for (i=0;i<size;i++)
+    for (j=0;j<size;j++)
+      dst[i*stride+j] = (unsigned char)clamp((int)lrintf(x[i*size+j] + 128.0f), 0, 255);
+}
+
+/* ----------------------------------------------- */
+
+#ifdef HAVE_AVX2
+void fdctQuantBlockAVX2(const unsigned char *src, int stride, const float *tab, int *dst, int dstStride);
+void quantBlockAVX2(const float *x, const float *tab, int *dst, int dstStride);
+void idctDequantBlockAVX2(const int *src, int srcStride, const float *tab, unsigned char *dst, int stride);
+
+static bool avx2Supported()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#else
+static bool avx2Supported()
+{
+  return false;
+}
+#endif
+
+static bool simd = avx2Supported();
+
+/* Enable or disable the SIMD kernels; returns whether they are in use */
+bool setSimd(bool enable)
+{
+  simd = enable && avx2Supported();
+  return simd;
+}
+
+/* Whether the SIMD kernels are in use (the color conversion follows this too) */
+bool simdMode()
+{
+  return simd;
+}
+
+void fdctQuantBlock(const unsigned char *src, int stride, const float *tab, int *dst, int dstStride)
+{
+#ifdef HAVE_AVX2
+  if (simd) {
+    fdctQuantBlockAVX2(src, stride, tab, dst, dstStride);
+    return;
+  }
+#endif
+  fdctQuantBlockC(src, stride, tab, dst, dstStride);
+}
+
+void quantBlock(const float *x, const float *tab, int *dst, int dstStride)
+{
+#ifdef HAVE_AVX2
+  if (simd) {
+    quantBlockAVX2(x, tab, dst, dstStride);
+    return;
+  }
+#endif
+  quantBlockC(x, tab, dst, dstStride);
+}
+
+void idctDequantBlock(const int *src, int srcStride, const float *tab, unsigned char *dst, int stride)
+{
+#ifdef HAVE_AVX2
+  if (simd) {
+    idctDequantBlockAVX2(src, srcStride, tab, dst, stride);
+    return;
+  }
+#endif
+  idctDequantBlockC(src, srcStride, tab, dst, stride);
+}
\ No newline at end of file
@@ -0,0 +1,210 @@
+/* AVX2 versions of the fused 8x8 block kernels in dct8.cpp */
+/* An 8x8 float block lives in eight __m256 registers, one row each.
+A 1-D pass applied across the registers transforms all eight columns at
+once; an in-register transpose then turns the rows into columns for the
+second pass, and a final transpose restores row order. Every lane performs
+exactly the float operations of the scalar kernels, in the same order, so
+the two paths produce bit-identical results. Only these functions are
+compiled for AVX2; dct8.cpp calls them after a run-time CPU check. */
+
+#include "myimage.h"
+
+#ifdef HAVE_AVX2
+
+#include <immintrin.h>
+
+#define AVX2_FN __attribute__((target("avx2")))
+
+AVX2_FN static inline void transpose8(__m256 *r)
+{
+  __m256 t0,t1,t2,t3,t4,t5,t6,t7;
+  __m256 u0,u1,u2,u3,u4,u5,u6,u7;
+
+  t0 = _mm256_unpacklo_ps(r[0], r[1]);
+  t1 = _mm256_unpackhi_ps(r[0], r[1]);
+  t2 = _mm256_unpacklo_ps(r[2], r[3]);
+  t3 = _mm256_unpackhi_ps(r[2], r[3]);
+  t4 = _mm256_unpacklo_ps(r[4], r[5]);
+  t5 = _mm256_unpackhi_ps(r[4], r[5]);
+  t6 = _mm256_unpacklo_ps(r[6], r[7]);
+  t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+  u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0));
+  u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+  u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0));
+  u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+  u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1,0,1,0));
+  u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3,2,3,2));
+  u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1,0,1,0));
+  u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3,2,3,2));
+
+  r[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+  r[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+  r[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+  r[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+  r[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+  r[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+  r[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+  r[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+/* Forward AAN pass across the eight registers; same steps as fdct8() */
+AVX2_FN static inline void fdct8v(__m256 *d)
+{
+  __m256 tmp0,tmp1,tmp2,tmp3,tmp4,tmp5,tmp6,tmp7;
+  __m256 tmp10,tmp11,tmp12,tmp13;
+  __m256 z1,z2,z3,z4,z5,z11,z13;
+
+  tmp0 = _mm256_add_ps(d[0], d[7]);
+  tmp7 = _mm256_sub_ps(d[0], d[7]);
+  tmp1 = _mm256_add_ps(d[1], d[6]);
+  tmp6 = _mm256_sub_ps(d[1], d[6]);
+  tmp2 = _mm256_add_ps(d[2], d[5]);
+  tmp5 = _mm256_sub_ps(d[2], d[5]);
+  tmp3 = _mm256_add_ps(d[3], d[4]);
+  tmp4 = _mm256_sub_ps(d[3], d[4]);
+
+  /* Even part */
+  tmp10 = _mm256_add_ps(tmp0, tmp3);
+  tmp13 = _mm256_sub_ps(tmp0, tmp3);
+  tmp11 = _mm256_add_ps(tmp1, tmp2);
+  tmp12 = _mm256_sub_ps(tmp1, tmp2);
+
+  d[0] = _mm256_add_ps(tmp10, tmp11);
+  d[4] = _mm256_sub_ps(tmp10, tmp11);
+
+  z1 = _mm256_mul_ps(_mm256_add_ps(tmp12, tmp13), _mm256_set1_ps(0.707106781f));
+  d[2] = _mm256_add_ps(tmp13, z1);
+  d[6] = _mm256_sub_ps(tmp13, z1);
+
+  /* Odd part */
+  tmp10 = _mm256_add_ps(tmp4, tmp5);
+  tmp11 = _mm256_add_ps(tmp5, tmp6);
+  tmp12 = _mm256_add_ps(tmp6, tmp7);
+
+  z5 = _mm256_mul_ps(_mm256_sub_ps(tmp10, tmp12), _mm256_set1_ps(0.382683433f));
+  z2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.541196100f), tmp10), z5);
+  z4 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(1.306562965f), tmp12), z5);
+  z3 = _mm256_mul_ps(tmp11, _mm256_set1_ps(0.707106781f));
+
+  z11 = _mm256_add_ps(tmp7, z3);
+  z13 = _mm256_sub_ps(tmp7, z3);
+
+  d[5] = _mm256_add_ps(z13, z2);
+  d[3] = _mm256_sub_ps(z13, z2);
+  d[1] = _mm256_add_ps(z11, z4);
+  d[7] = _mm256_sub_ps(z11, z4);
+}
+
+/* Inverse AAN pass across the eight registers; same steps as idct8() */
+AVX2_FN static inline void idct8v(__m256 *d)
+{
+  __m256 tmp0,tmp1,tmp2,tmp3,tmp4,tmp5,tmp6,tmp7;
+  __m256 tmp10,tmp11,tmp12,tmp13;
+  __m256 z5,z10,z11,z12,z13;
+
+  /* Even part */
+  tmp0 = d[0];
+  tmp1 = d[2];
+  tmp2 = d[4];
+  tmp3 = d[6];
+
+  tmp10 = _mm256_add_ps(tmp0, tmp2);
+  tmp11 = _mm256_sub_ps(tmp0, tmp2);
+
+  tmp13 = _mm256_add_ps(tmp1, tmp3);
+  tmp12 = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(tmp1, tmp3), _mm256_set1_ps(1.414213562f)), tmp13);
+
+  tmp0 = _mm256_add_ps(tmp10, tmp13);
+  tmp3 = _mm256_sub_ps(tmp10, tmp13);
+  tmp1 = _mm256_add_ps(tmp11, tmp12);
+  tmp2 = _mm256_sub_ps(tmp11, tmp12);
+
+  /* Odd part */
+  tmp4 = d[1];
+  tmp5 = d[3];
+  tmp6 = d[5];
+  tmp7 = d[7];
+
+  z13 = _mm256_add_ps(tmp6, tmp5);
+  z10 = _mm256_sub_ps(tmp6, tmp5);
+  z11 = _mm256_add_ps(tmp4, tmp7);
+  z12 = _mm256_sub_ps(tmp4, tmp7);
+
+  tmp7 = _mm256_add_ps(z11, z13);
+  tmp11 = _mm256_mul_ps(_mm256_sub_ps(z11, z13), _mm256_set1_ps(1.414213562f));
+
+  z5 = _mm256_mul_ps(_mm256_add_ps(z10, z12), _mm256_set1_ps(1.847759065f));
+  tmp10 = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(1.082392200f), z12), z5);
+  tmp12 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(-2.613125930f), z10), z5);
+
+  tmp6 = _mm256_sub_ps(tmp12, tmp7);
+  tmp5 = _mm256_sub_ps(tmp11, tmp6);
+  tmp4 = _mm256_add_ps(tmp10, tmp5);
+
+  d[0] = _mm256_add_ps(tmp0, tmp7);
+  d[7] = _mm256_sub_ps(tmp0, tmp7);
+  d[1] = _mm256_add_ps(tmp1, tmp6);
+  d[6] = _mm256_sub_ps(tmp1, tmp6);
+  d[2] = _mm256_add_ps(tmp2, tmp5);
+  d[5] = _mm256_sub_ps(tmp2, tmp5);
+  d[4] = _mm256_add_ps(tmp3, tmp4);
+  d[3] = _mm256_sub_ps(tmp3, tmp4);
+}
+
+/* ----------------------------------------------- */
+
+AVX2_FN void fdctQuantBlockAVX2(const unsigned char *src, int stride, const float *tab, int *dst, int dstStride)
+{
+  __m256 r[8];
+  const __m256i shift = _mm256_set1_epi32(128);
+
+  for (int i=0;i<8;i++) {
+    __m256i p = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i*stride)));
+    r[i] = _mm256_cvtepi32_ps(_mm256_sub_epi32(p, shift));
+  }
+
+  fdct8v(r);       /* columns */
+  transpose8(r);
+  fdct8v(r);       /* rows */
+  transpose8(r);
+
+  /* Quantize with a reciprocal multiply, rounding to nearest like lrintf */
+  for (int i=0;i<8;i++) {
+    __m256 q = _mm256_mul_ps(r[i], _mm256_loadu_ps(tab + i*8));
+    _mm256_storeu_si256((__m256i *)(dst + i*dstStride), _mm256_cvtps_epi32(q));
+  }
+}
+
+AVX2_FN void quantBlockAVX2(const float *x, const float *tab, int *dst, int dstStride)
+{
+  for (int i=0;i<8;i++) {
+    __m256 q = _mm256_mul_ps(_mm256_loadu_ps(x + i*8), _mm256_loadu_ps(tab + i*8));
+    _mm256_storeu_si256((__m256i *)(dst + i*dstStride), _mm256_cvtps_epi32(q));
+  }
+}
+
+AVX2_FN void idctDequantBlockAVX2(const int *src, int srcStride, const float *tab, unsigned char *dst, int stride)
+{
+  __m256 r[8];
+  const __m256 shift = _mm256_set1_ps(128.0f);
+
+  for (int i=0;i<8;i++) {
+    __m256 c = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(src + i*srcStride)));
+    r[i] = _mm256_mul_ps(c, _mm256_loadu_ps(tab + i*8));
+  }
+
+  idct8v(r);       /* columns */
+  transpose8(r);
+  idct8v(r);       /* rows */
+  transpose8(r);
+
+  /* Level shift, round and clamp to [0,255] through saturating packs */
+  for (int i=0;i<8;i++) {
+    __m256i v = _mm256_cvtps_epi32(_mm256_add_ps(r[i], shift));
+    __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64((__m128i *)(dst + i*stride), _mm_packus_epi16(w, w));
+  }
+}
+
+#endif
\ No newline at end of file
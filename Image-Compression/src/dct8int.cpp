@@ -0,0 +1,319 @@
+/* Fixed-point 8x8 DCT program */
+/* Integer-only versions of the fused block kernels in dct8.cpp, used when
+the codec runs in fixed-point mode ("setFixedPoint(true)", the -fixed
+option). The transforms are the Loeffler-Ligtenberg-Moschytz factorization
+used by the IJG "islow" DCT: 12 multiplies and 32 additions per 1-D pass,
+with constants scaled by 2^CONST_BITS and PASS1_BITS extra bits of
+precision kept between the two passes. Quantization multiplies by a
+precomputed integer reciprocal and dequantization by an integer step with
+FRAC_BITS fractional bits, both built once per QF. No float or double
+arithmetic is used per block, so the output is identical on every platform
+and compiler. */
+
+#include "myimage.h"
+
+#define CONST_BITS  13
+#define PASS1_BITS  2
+#define QUANT_BITS  24   /* fraction bits of the quantization reciprocals */
+#define STEP_BITS   16   /* fraction bits of the dequantization steps */
+#define FRAC_BITS   2    /* fraction bits of dequantized coefficients */
+#define COEF_MAX    (2048 << FRAC_BITS)
+
+#define FIX_0_298631336  2446
+#define FIX_0_390180644  3196
+#define FIX_0_541196100  4433
+#define FIX_0_765366865  6270
+#define FIX_0_899976223  7373
+#define FIX_1_175875602  9633
+#define FIX_1_306562965  10703
+#define FIX_1_501321110  12299
+#define FIX_1_847759065  15137
+#define FIX_1_961570560  16069
+#define FIX_2_053119869  16819
+#define FIX_2_562915447  20995
+#define FIX_3_072711026  25172
+
+/* Divide by 2^n, rounding to nearest */
+#define DESCALE(x,n)  (((x) + (1 << ((n)-1))) >> (n))
+
+/* One forward 1-D pass over 8 elements spaced "s" apart. The first pass
+(pass1 = 1) leaves its outputs scaled up by 2^PASS1_BITS and the second
+removes that scale again, so after both passes the result is the
+orthonormal DCT times 8. */
+static inline void fdct8i(int *d, int s, int pass1)
+{
+  int tmp0,tmp1,tmp2,tmp3,tmp4,tmp5,tmp6,tmp7;
+  int tmp10,tmp11,tmp12,tmp13;
+  int z1,z2,z3,z4,z5;
+  const int odd = pass1 ? CONST_BITS-PASS1_BITS : CONST_BITS+PASS1_BITS;
+
+  tmp0 = d[0*s] + d[7*s];
+  tmp7 = d[0*s] - d[7*s];
+  tmp1 = d[1*s] + d[6*s];
+  tmp6 = d[1*s] - d[6*s];
+  tmp2 = d[2*s] + d[5*s];
+  tmp5 = d[2*s] - d[5*s];
+  tmp3 = d[3*s] + d[4*s];
+  tmp4 = d[3*s] - d[4*s];
+
+  /* Even part */
+  tmp10 = tmp0 + tmp3;
+  tmp13 = tmp0 - tmp3;
+  tmp11 = tmp1 + tmp2;
+  tmp12 = tmp1 - tmp2;
+
+  if (pass1) {
+    d[0*s] = (tmp10 + tmp11) * (1 << PASS1_BITS);
+    d[4*s] = (tmp10 - tmp11) * (1 << PASS1_BITS);
+  } else {
+    d[0*s] = DESCALE(tmp10 + tmp11, PASS1_BITS);
+    d[4*s] = DESCALE(tmp10 - tmp11, PASS1_BITS);
+  }
+
+  z1 = (tmp12 + tmp13) * FIX_0_541196100;
+  d[2*s] = DESCALE(z1 + tmp13 * FIX_0_765366865, odd);
+  d[6*s] = DESCALE(z1 - tmp12 * FIX_1_847759065, odd);
+
+  /* Odd part */
+  z1 = tmp4 + tmp7;
+  z2 = tmp5 + tmp6;
+  z3 = tmp4 + tmp6;
+  z4 = tmp5 + tmp7;
+  z5 = (z3 + z4) * FIX_1_175875602;
+
+  tmp4 *= FIX_0_298631336;
+  tmp5 *= FIX_2_053119869;
+  tmp6 *= FIX_3_072711026;
+  tmp7 *= FIX_1_501321110;
+  z1 *= -FIX_0_899976223;
+  z2 *= -FIX_2_562915447;
+  z3 = z3 * -FIX_1_961570560 + z5;
+  z4 = z4 * -FIX_0_390180644 + z5;
+
+  d[7*s] = DESCALE(tmp4 + z1 + z3, odd);
+  d[5*s] = DESCALE(tmp5 + z2 + z4, odd);
+  d[3*s] = DESCALE(tmp6 + z2 + z3, odd);
+  d[1*s] = DESCALE(tmp7 + z1 + z4, odd);
+}
+
+/* One inverse 1-D pass over 8 elements spaced "s" apart, descaling the
+outputs by 2^shift */
+static inline void idct8i(int *d, int s, int shift)
+{
+  int tmp0,tmp1,tmp2,tmp3;
+  int tmp10,tmp11,tmp12,tmp13;
+  int z1,z2,z3,z4,z5;
+
+  /* Even part */
+  z2 = d[2*s];
+  z3 = d[6*s];
+  z1 = (z2 + z3) * FIX_0_541196100;
+  tmp2 = z1 - z3 * FIX_1_847759065;
+  tmp3 = z1 + z2 * FIX_0_765366865;
+
+  tmp0 = (d[0*s] + d[4*s]) * (1 << CONST_BITS);
+  tmp1 = (d[0*s] - d[4*s]) * (1 << CONST_BITS);
+
+  tmp10 = tmp0 + tmp3;
+  tmp13 = tmp0 - tmp3;
+  tmp11 = tmp1 + tmp2;
+  tmp12 = tmp1 - tmp2;
+
+  /* Odd part */
+  tmp0 = d[7*s];
+  tmp1 = d[5*s];
+  tmp2 = d[3*s];
+  tmp3 = d[1*s];
+
+  z1 = tmp0 + tmp3;
+  z2 = tmp1 + tmp2;
+  z3 = tmp0 + tmp2;
+  z4 = tmp1 + tmp3;
+  z5 = (z3 + z4) * FIX_1_175875602;
+
+  tmp0 *= FIX_0_298631336;
+  tmp1 *= FIX_2_053119869;
+  tmp2 *= FIX_3_072711026;
+  tmp3 *= FIX_1_501321110;
+  z1 *= -FIX_0_899976223;
+  z2 *= -FIX_2_562915447;
+  z3 = z3 * -FIX_1_961570560 + z5;
+  z4 = z4 * -FIX_0_390180644 + z5;
+
+  tmp0 += z1 + z3;
+  tmp1 += z2 + z4;
+  tmp2 += z2 + z3;
+  tmp3 += z1 + z4;
+
+  d[0*s] = DESCALE(tmp10 + tmp3, shift);
+  d[7*s] = DESCALE(tmp10 - tmp3, shift);
+  d[1*s] = DESCALE(tmp11 + tmp2, shift);
+  d[6*s] = DESCALE(tmp11 - tmp2, shift);
+  d[2*s] = DESCALE(tmp12 + tmp1, shift);
+  d[5*s] = DESCALE(tmp12 - tmp1, shift);
+  d[3*s] = DESCALE(tmp13 + tmp0, shift);
+  d[4*s] = DESCALE(tmp13 - tmp0, shift);
+}
+
+/* ----------------------------------------------- */
+
+/* Quantization table for fdctQuantBlockInt: 2^QUANT_BITS / (8*q*100/QF),
+the 8 being the scale of the transform output. QF = 0 quantizes everything
+to zero, like the float tables. */
+void fdctQuantTableInt(const int q[8][8], int QF, int32_t *tab)
+{
+  for (int i = 0; i < 64; i++) {
+    int64_t div = 8LL * q[i/8][i%8] * 100;
+    tab[i] = (int32_t)((((int64_t)QF << QUANT_BITS) + div / 2) / div);
+  }
+}
+
+/* Dequantization table for idctDequantBlockInt: q*100/QF with STEP_BITS
+fraction bits */
+void idctDequantTableInt(const int q[8][8], int QF, int32_t *tab)
+{
+  QF = max(QF, 1);
+  for (int i = 0; i < 64; i++)
+    tab[i] = (int32_t)((((int64_t)q[i/8][i%8] * 100 << STEP_BITS) + QF / 2) / QF);
+}
+
+/* Level shift and forward DCT one 8x8 block of pixels into x (the DCT
+times 8), to be quantized by quantBlockInt */
+void fdctBlockInt(const unsigned char *src, int stride, int *x)
+{
+  int i,j;
+
+  for (i=0;i<8;i++)
+    for (j=0;j<8;j++)
+      x[i*8+j] = src[i*stride+j] - 128;
+
+  for (i=0;i<8;i++)
+    fdct8i(x + i*8, 1, 1);   /* rows */
+  for (i=0;i<8;i++)
+    fdct8i(x + i, 8, 0);     /* columns */
+}
+
+/* Quantize one block of fdctBlockInt output with a reciprocal multiply,
+rounding halves away from zero */
+void quantBlockInt(const int *x, const int32_t *tab, int *dst, int dstStride)
+{
+  int i,j;
+
+  for (i=0;i<8;i++)
+    for (j=0;j<8;j++) {
+      int v = x[i*8+j];
+      int64_t m = ((int64_t)(v < 0 ? -v : v) * tab[i*8+j] + (1 << (QUANT_BITS-1))) >> QUANT_BITS;
+      dst[i*dstStride+j] = (int)(v < 0 ? -m : m);
+    }
+}
+
+/* Level shift, forward DCT and quantize one 8x8 block of pixels */
+void fdctQuantBlockInt(const unsigned char *src, int stride, const int32_t *tab, int *dst, int dstStride)
+{
+  int x[64];
+
+  fdctBlockInt(src, stride, x);
+  quantBlockInt(x, tab, dst, dstStride);
+}
+
+/* Dequantize, inverse DCT, level shift and clamp one 8x8 block of coefficients */
+void idctDequantBlockInt(const int *src, int srcStride, const int32_t *tab, unsigned char *dst, int stride)
+{
+  int x[64];
+  int i,j;
+
+  /* Dequantized coefficients keep FRAC_BITS fraction bits; the clamp is
+  far above any coefficient of an 8-bit image and only bounds corrupt input */
+  for (i=0;i<8;i++)
+    for (j=0;j<8;j++) {
+      int64_t c = ((int64_t)src[i*srcStride+j] * tab[i*8+j] + (1 << (STEP_BITS-FRAC_BITS-1))) >> (STEP_BITS-FRAC_BITS);
+      x[i*8+j] = (int)clamp<int64_t>(c, -COEF_MAX, COEF_MAX);
+    }
+
+  for (i=0;i<8;i++)
+    idct8i(x + i, 8, CONST_BITS-PASS1_BITS+FRAC_BITS);   /* columns */
+  for (i=0;i<8;i++)
+    idct8i(x + i*8, 1, CONST_BITS+PASS1_BITS+3);         /* rows */
+
+  for (i=0;i<8;i++)
+    for (j=0;j<8;j++)
+      dst[i*stride+j] = (unsigned char)clamp(x[i*8+j] + 128, 0, 255);
+}
+
+/* DC-only block: the passes reduce to scaling the DC term, which fills the
+size x size output block */
+void idctDequantDCInt(int dc, const int32_t *tab, int size, unsigned char *dst, int stride)
+{
+  int64_t c = ((int64_t)dc * tab[0] + (1 << (STEP_BITS-FRAC_BITS-1))) >> (STEP_BITS-FRAC_BITS);
+  int x = (int)clamp<int64_t>(c, -COEF_MAX, COEF_MAX);
+  x = DESCALE(x * (1 << CONST_BITS), CONST_BITS-PASS1_BITS+FRAC_BITS);
+  x = DESCALE(x * (1 << CONST_BITS), CONST_BITS+PASS1_BITS+3);
+  unsigned char v = (unsigned char)clamp(x + 128, 0, 255);
+  for (int i=0;i<size;i++)
+    memset(dst + i*stride, v, size);
+}
+
+/* One reduced inverse 1-D pass of "size" (4, 2 or 1) points, the integer
+version of idctReduced in dct8.cpp */
+static inline void idctReducedi(int *d, int s, int size, int shift)
+{
+  int tmp0,tmp1,tmp10,tmp11;
+
+  if (size == 4) {
+    tmp0 = (d[0*s] + d[2*s]) * (1 << CONST_BITS);
+    tmp1 = (d[0*s] - d[2*s]) * (1 << CONST_BITS);
+    tmp10 = d[1*s] * FIX_1_306562965 + d[3*s] * FIX_0_541196100;
+    tmp11 = d[1*s] * FIX_0_541196100 - d[3*s] * FIX_1_306562965;
+
+    d[0*s] = DESCALE(tmp0 + tmp10, shift);
+    d[3*s] = DESCALE(tmp0 - tmp10, shift);
+    d[1*s] = DESCALE(tmp1 + tmp11, shift);
+    d[2*s] = DESCALE(tmp1 - tmp11, shift);
+  } else if (size == 2) {
+    tmp0 = d[0*s] * (1 << CONST_BITS);
+    tmp1 = d[1*s] * (1 << CONST_BITS);
+    d[0*s] = DESCALE(tmp0 + tmp1, shift);
+    d[1*s] = DESCALE(tmp0 - tmp1, shift);
+  } else {
+    d[0] = DESCALE(d[0] * (1 << CONST_BITS), shift);
+  }
+}
+
+/* Dequantize and inverse transform the top-left size x size coefficients
+of one 8x8 block into a size x size block of pixels (the idctDequantBlockInt
+tables) */
+void idctDequantReducedInt(const int *src, int srcStride, const int32_t *tab, int size, unsigned char *dst, int stride)
+{
+  int x[16];
+  int i,j;
+
+  for (i=0;i<size;i++)
+    for (j=0;j<size;j++) {
+      int64_t c = ((int64_t)src[i*srcStride+j] * tab[i*8+j] + (1 << (STEP_BITS-FRAC_BITS-1))) >> (STEP_BITS-FRAC_BITS);
+      x[i*size+j] = (int)clamp<int64_t>(c, -COEF_MAX, COEF_MAX);
+    }
+
+  for (i=0;i<size;i++)
+    idctReducedi(x + i, size, size, CONST_BITS-PASS1_BITS+FRAC_BITS);   /* columns */
+  for (i=0;i<size;i++)
+    idctReducedi(x + i*size, 1, size, CONST_BITS+PASS1_BITS+3);         /* rows */
+
+  for (i=0;i<size;i++)
+    for (j=0;j<size;j++)
+      dst[i*stride+j] = (unsigned char)clamp(x[i*size+j] + 128, 0, 255);
+}
+
+/* ----------------------------------------------- */
+
+static bool fixedPoint = false;
+
+/* Switch the color conversion and block kernels to the integer-only code */
+void setFixedPoint(bool enable)
+{
+  fixedPoint = enable;
+}
+
+bool fixedPointMode()
+{
+  return fixedPoint;
+}
\ No newline at end of file
@@ -0,0 +1,121 @@
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bitstream.h"
+
+// Symbol alphabets: DC symbols are the magnitude category (0-11); AC symbols
+// are run * 11 + category (0-175), with 0 = EOB and 165 = ZRL.
+const int DC_SYMBOLS = 12;
+const int AC_SYMBOLS = 176;
+
+// Largest magnitude of a quantized level: AC levels have categories up to
+// 10, and with DC levels within it every DC difference fits in category 11.
+// Only quantization steps below 1 (QF 1-4) make larger levels, which are
+// clipped to it (see packBlock).
+const int MAX_LEVEL = 1023;
+
+// Zigzag bands of the AC symbols, by the position of the last coded
+// coefficient of the block (0: the DC, so the first AC symbol). The rANS
+// coder uses one context per band.
+const int AC_BANDS = 4;
+
+inline int acBand(int k) { return k == 0 ? 0 : k < 6 ? 1 : k < 21 ? 2 : 3; }
+
+// Entropy coding of the symbols, chosen per file
+enum EntropyCoder { HUFFMAN, RANS };
+
+// Magnitude category of a coefficient: the number of bits of |v| (0 for 0),
+// from a count-leading-zeros instruction where the compiler has one
+inline int magnitudeCategory(int v) {
+    unsigned a = static_cast<unsigned>(v < 0 ? -v : v);
+#if defined(__GNUC__) || defined(__clang__)
+    return a ? 32 - __builtin_clz(a) : 0;
+#else
+    int cat = 0;
+    for (; a; a >>= 1) ++cat;
+    return cat;
+#endif
+}
+
+// Packed Huffman code: the low `len` bits of `code`, MSB first (len 0: unused symbol)
+struct HuffCode {
+    uint16_t code;
+    uint8_t len;
+};
+
+// Canonical Huffman table in JPEG DHT form
+struct HuffmanSpec {
+    unsigned char bits[17] = {};       // bits[l]: number of codes of length l (1-16)
+    std::vector<unsigned char> vals;   // Symbols in order of increasing code
+};
+
+// Table-driven Huffman decoder.
+// The first LOOKUP bits of the stream index a table that resolves every code
+// of up to LOOKUP bits in one step. Longer codes (up to 16 bits) land on an
+// entry pointing to a second-level table indexed by the remaining bits.
+class HuffDecoder {
+public:
+    static const int LOOKUP = 9;
+    static const int SUBBITS = 16 - LOOKUP;
+
+    HuffDecoder() { for (Entry& e : fast) e = {-1, 0}; }
+    HuffDecoder(const HuffCode* codes, int size);
+
+    // Decode one symbol, or return -1 for a bit pattern that is not a valid code
+    inline int decode(BitReader& br) const {
+        uint32_t bits = br.peek(16);
+        const Entry& e = fast[bits >> SUBBITS];
+        if (e.len) {
+            br.skip(e.len);
+            return e.symbol;
+        }
+        if (e.symbol < 0) return -1;
+        const Entry& s = sub[(e.symbol << SUBBITS) | (bits & ((1 << SUBBITS) - 1))];
+        if (!s.len) return -1;
+        br.skip(s.len);
+        return s.symbol;
+    }
+
+private:
+    struct Entry {
+        int16_t symbol;   // Decoded symbol, or subtable number when len == 0 (-1: invalid)
+        uint8_t len;      // Total code length, 0 for the slow path
+    };
+
+    Entry fast[1 << LOOKUP];
+    std::vector<Entry> sub;
+};
+
+struct RansSpec;
+struct RansModel;
+
+// Encode and decode tables for luminance and chrominance DC/AC, or the
+// rANS model of a file coded with rANS
+struct EntropyTables {
+    EntropyCoder coder = HUFFMAN;
+    HuffCode luDC[DC_SYMBOLS], chDC[DC_SYMBOLS], luAC[AC_SYMBOLS], chAC[AC_SYMBOLS];
+    HuffDecoder dLuDC, dChDC, dLuAC, dChAC;
+    std::shared_ptr<const RansModel> rans;      // coder == RANS
+
+    EntropyTables();                            // Standard tables of HuffmanTable.h
+    explicit EntropyTables(const HuffmanSpec* specs);  // luDC, luAC, chDC, chAC
+    explicit EntropyTables(const RansSpec& spec);
+};
+
+// Symbol counts gathered by a statistics pass
+struct SymbolStats {
+    uint32_t luDC[DC_SYMBOLS] = {}, chDC[DC_SYMBOLS] = {};
+    uint32_t luAC[AC_SYMBOLS] = {}, chAC[AC_SYMBOLS] = {};
+    uint32_t luBand[AC_BANDS][AC_SYMBOLS] = {}, chBand[AC_BANDS][AC_SYMBOLS] = {};   // AC counts per band
+    void add(const SymbolStats& o);
+};
+
+const EntropyTables& defaultTables();
+HuffmanSpec buildHuffmanSpec(const uint32_t* freq, int size);
+bool huffmanCodes(const HuffmanSpec& spec, HuffCode* codes, int size);
+
+#endif
\ No newline at end of file
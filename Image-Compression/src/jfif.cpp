@@ -0,0 +1,315 @@
+#include "myimage.h"
+
+// Baseline JFIF output: the quantized coefficients of a frame written as a
+// standard sequential JPEG file (SOI, APP0, DQT, SOF0, DHT, SOS, EOI) that
+// any JPEG decoder reads. The color conversion, DCT and zigzag order are
+// those of baseline JPEG already, so nothing is transformed again: the
+// blocks are only put in JPEG's interleaved MCU order and Huffman coded with
+// JPEG's symbols, DC prediction and byte stuffing.
+
+// Index in JPEG's zigzag order of each raster position of a block. This
+// codec's own order (zigzagPos) is its transpose, so the coefficients are
+// reordered through their raster positions.
+static const unsigned char jpegIndex[64] = {
+   0,  1,  5,  6, 14, 15, 27, 28,
+   2,  4,  7, 13, 16, 26, 29, 42,
+   3,  8, 12, 17, 25, 30, 41, 43,
+   9, 11, 18, 24, 31, 40, 44, 53,
+  10, 19, 23, 32, 39, 45, 52, 54,
+  20, 22, 33, 38, 46, 51, 55, 60,
+  21, 34, 37, 47, 50, 56, 59, 61,
+  35, 36, 48, 49, 57, 58, 62, 63
+};
+
+// Quantization of one component in JPEG terms: the 8-bit table in zigzag
+// order, and the factor from a level of this codec to a level of that table
+struct JpegQuant {
+    unsigned char q[64];
+    float factor[64];
+    bool exact = true;          // All factors 1: the levels carry over unchanged
+};
+
+// The quantization step of this codec is q * 100 / QF, not JPEG's integer
+// (q * QF + 50) / 100. Steps that are whole numbers up to 255 (every step
+// of QF 50, 75 or 90, for instance) are stored as they are; the others are
+// rounded to the nearest 8-bit step and the levels requantized to it.
+static JpegQuant jpegQuant(const int q[8][8], int QF) {
+    JpegQuant jq;
+    for (int pos = 0; pos < 64; ++pos) {
+        const int k = jpegIndex[pos];
+        const double step = QF > 0 ? q[pos / 8][pos % 8] * 100.0 / QF : 255;
+        jq.q[k] = static_cast<unsigned char>(clamp(lround(step), 1L, 255L));
+        jq.factor[k] = static_cast<float>(step / jq.q[k]);
+        if (jq.q[k] != step)
+            jq.exact = false;
+    }
+    return jq;
+}
+
+// Expand the pairs of one block into its 64 levels in JPEG's zigzag order,
+// in the JPEG quantization `jq`; returns the pairs of the next block.
+// Levels are kept in the range of baseline coefficients: the DC of a decoded
+// file is a running sum that a corrupt stream can take anywhere.
+static const RunLevel* zigzagLevels(const RunLevel* p, int dc, const JpegQuant& jq, int* zz) {
+    fill(zz, zz + 64, 0);
+    zz[0] = clamp(dc, -MAX_LEVEL, MAX_LEVEL);
+    for (int k = 0; p->level != 0; ++p) {
+        k += p->run + 1;
+        zz[jpegIndex[zigzagPos[k]]] = p->level;
+    }
+    if (!jq.exact) {
+        zz[0] = clamp(static_cast<int>(lround(zz[0] * jq.factor[0])), -1024, 1023);
+        for (int k = 1; k < 64; ++k)
+            zz[k] = clamp(static_cast<int>(lround(zz[k] * jq.factor[k])), -1023, 1023);
+    }
+    return p + 1;
+}
+
+// Symbol sinks for scanBlock(), as in HuffmanCode.cpp: one counts the
+// symbols of each table for optimized tables, one writes their codes.
+// Symbols are in this codec's alphabet (run * 11 + category).
+struct JpegCountSink {
+    uint32_t* DC;
+    uint32_t* AC;
+    inline void dc(int cat, int) { DC[cat]++; }
+    inline void ac(int symbol, int, int) { AC[symbol]++; }
+};
+
+struct JpegCodeSink {
+    const HuffCode* DC;
+    const HuffCode* AC;
+    BitWriter& bw;
+    inline void dc(int cat, int val) {
+        bw.put((uint32_t(DC[cat].code) << cat) | (val < 0 ? val + (1 << cat) - 1 : val), DC[cat].len + cat);
+    }
+    inline void ac(int symbol, int cat, int val) {
+        bw.put((uint32_t(AC[symbol].code) << cat) | (val < 0 ? val + (1 << cat) - 1 : val), AC[symbol].len + cat);
+    }
+};
+
+// Code one block of zigzag levels the JPEG way: a ZRL for each 16 zeros
+// before a level, and no end-of-block after a last coefficient at 63
+template <class Sink>
+static void scanBlock(const int* zz, int& pred, Sink& out) {
+    const int diff = zz[0] - pred;
+    pred = zz[0];
+    out.dc(magnitudeCategory(diff), diff);
+
+    int run = 0;
+    for (int k = 1; k < 64; ++k) {
+        if (zz[k] == 0) {
+            ++run;
+            continue;
+        }
+        for (; run > 15; run -= 16)
+            out.ac(15 * 11, 0, 0); // ZRL
+        const int cat = magnitudeCategory(zz[k]);
+        out.ac(run * 11 + cat, cat, zz[k]);
+        run = 0;
+    }
+    if (run > 0)
+        out.ac(0, 0, 0);           // End-of-block
+}
+
+// Frame layout of a JPEG file: the sampling factors of the luminance (the
+// chrominance components are 1x1) and the number of MCUs
+struct JpegLayout {
+    int H, V;
+    int mcuCols, mcuRows;
+};
+
+static JpegLayout jpegLayout(int width, int height, Sampling s) {
+    JpegLayout l;
+    l.H = (s == YUV420 || s == YUV422) ? 2 : 1;
+    l.V = s == YUV420 ? 2 : 1;
+    l.mcuCols = (width + 8 * l.H - 1) / (8 * l.H);
+    l.mcuRows = (height + 8 * l.V - 1) / (8 * l.V);
+    return l;
+}
+
+// Walk the blocks of the frame in JPEG scan order and send each one to `lu`
+// or `ch`: for a gray image the blocks of its rows, for a color image the
+// MCUs, each with H x V luminance blocks, then one U and one V block. The
+// blocks past the JPEG frame (this codec pads color images to 16 pixels)
+// are left out.
+template <class Sink>
+static void scanFrame(const SparseCoefs& coef, Sampling s, const JpegLayout& l,
+                      const JpegQuant& luq, const JpegQuant& chq, Sink& lu, Sink& ch) {
+    int zz[64];
+    int pred[3] = {};
+    const int chromaRows = static_cast<int>(coef.rows.size()) - coef.lumaRows;
+    for (int my = 0; my < l.mcuRows; ++my) {
+        // Next block of each block row of this MCU row
+        const RunLevel* lumaBlock[2];
+        for (int v = 0; v < l.V; ++v)
+            lumaBlock[v] = coef.row(false, my * l.V + v).ac.data();
+        const RunLevel* chromaBlock[2] = {};
+        if (s != GRAY) {
+            chromaBlock[0] = coef.row(true, my).ac.data();
+            chromaBlock[1] = coef.row(true, chromaRows / 2 + my).ac.data();
+        }
+
+        for (int mx = 0; mx < l.mcuCols; ++mx) {
+            for (int v = 0; v < l.V; ++v) {
+                const CoefRow& row = coef.row(false, my * l.V + v);
+                for (int h = 0; h < l.H; ++h) {
+                    lumaBlock[v] = zigzagLevels(lumaBlock[v], row.dc[mx * l.H + h], luq, zz);
+                    scanBlock(zz, pred[0], lu);
+                }
+            }
+            if (s == GRAY)
+                continue;
+            for (int c = 0; c < 2; ++c) {
+                const CoefRow& row = coef.row(true, c * chromaRows / 2 + my);
+                chromaBlock[c] = zigzagLevels(chromaBlock[c], row.dc[mx], chq, zz);
+                scanBlock(zz, pred[1 + c], ch);
+            }
+        }
+    }
+}
+
+static void putMarker(vector<unsigned char>& out, int marker, int length) {
+    out.push_back(0xFF);
+    out.push_back(static_cast<unsigned char>(marker));
+    out.push_back(static_cast<unsigned char>(length >> 8));
+    out.push_back(static_cast<unsigned char>(length));
+}
+
+// DHT entry of one table (class tc, number th): its code counts, then its
+// symbols in JPEG's alphabet, in code order. This codec's codes are
+// canonical, so ordering the symbols by code gives the same codes back.
+static void putTable(vector<unsigned char>& out, int tc, int th, const HuffCode* codes, int size) {
+    vector<int> symbols;
+    for (int s = 0; s < size; ++s)
+        if (codes[s].len) symbols.push_back(s);
+    sort(symbols.begin(), symbols.end(), [&](int a, int b) {
+        return codes[a].len != codes[b].len ? codes[a].len < codes[b].len : codes[a].code < codes[b].code;
+    });
+    unsigned char bits[17] = {};
+    for (int s : symbols) bits[codes[s].len]++;
+
+    out.push_back(static_cast<unsigned char>(tc << 4 | th));
+    out.insert(out.end(), bits + 1, bits + 17);
+    for (int s : symbols)
+        out.push_back(static_cast<unsigned char>(tc ? (s / 11) << 4 | s % 11 : s));
+}
+
+// Write the coefficients `coef` of the frame described by `header` (size,
+// sampling, quality) as a baseline JFIF file into `out`. With `optimize`
+// the Huffman tables are fitted to the symbols of the JPEG scan (two
+// passes), else the standard tables are used. Returns false for an image
+// larger than JPEG's 65535 x 65535.
+bool writeJfif(const SparseCoefs& coef, const ImageHeader& header, bool optimize, vector<unsigned char>& out) {
+    const int width = header.width, height = header.height;
+    if (width > 65535 || height > 65535) {
+        cerr << "JFIF images are at most 65535 x 65535 pixels.\n";
+        return false;
+    }
+    const Sampling s = header.sampling;
+    const bool gray = s == GRAY;
+    const int components = gray ? 1 : 3;
+    const int QF = qualityScale(header.quality);
+    const JpegQuant luq = jpegQuant(luminanceQuantMatrix, QF);
+    const JpegQuant chq = jpegQuant(chrominanceQuantMatrix, QF);
+    const JpegLayout layout = jpegLayout(width, height, s);
+    if (!luq.exact || (!gray && !chq.exact))
+        cerr << "Warning: the quantization steps of QF " << header.quality << " are not all whole numbers up to 255; "
+                "the JFIF file requantizes the levels to 8-bit steps, which lowers the PSNR (0.01-0.07 dB at QF 10-80, "
+                "up to 0.35 dB at QF 5).\n";
+
+    // Huffman codes: the standard tables, or tables built from the symbol
+    // counts of a first pass over the scan
+    HuffCode luDC[DC_SYMBOLS], chDC[DC_SYMBOLS], luAC[AC_SYMBOLS], chAC[AC_SYMBOLS];
+    if (optimize) {
+        SymbolStats stats;
+        JpegCountSink lu{stats.luDC, stats.luAC}, ch{stats.chDC, stats.chAC};
+        scanFrame(coef, s, layout, luq, chq, lu, ch);
+        huffmanCodes(buildHuffmanSpec(stats.luDC, DC_SYMBOLS), luDC, DC_SYMBOLS);
+        huffmanCodes(buildHuffmanSpec(stats.luAC, AC_SYMBOLS), luAC, AC_SYMBOLS);
+        if (!gray) {
+            huffmanCodes(buildHuffmanSpec(stats.chDC, DC_SYMBOLS), chDC, DC_SYMBOLS);
+            huffmanCodes(buildHuffmanSpec(stats.chAC, AC_SYMBOLS), chAC, AC_SYMBOLS);
+        }
+    } else {
+        const EntropyTables& t = defaultTables();
+        copy(t.luDC, t.luDC + DC_SYMBOLS, luDC);
+        copy(t.chDC, t.chDC + DC_SYMBOLS, chDC);
+        copy(t.luAC, t.luAC + AC_SYMBOLS, luAC);
+        copy(t.chAC, t.chAC + AC_SYMBOLS, chAC);
+    }
+
+    // Entropy-coded scan, padded with 1 bits to a whole byte
+    vector<unsigned char> scan;
+    {
+        BitWriter bw(scan);
+        JpegCodeSink lu{luDC, luAC, bw}, ch{chDC, chAC, bw};
+        scanFrame(coef, s, layout, luq, chq, lu, ch);
+        const int pad = static_cast<int>((8 - bw.bitCount() % 8) % 8);
+        bw.put((1u << pad) - 1, pad);
+        bw.flush();
+    }
+
+    out.clear();
+    out.reserve(scan.size() + scan.size() / 64 + 1024);
+    out.push_back(0xFF);
+    out.push_back(0xD8);                                    // SOI
+
+    // APP0: JFIF 1.01, no units, 1:1 pixel aspect ratio
+    static const unsigned char app0[] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    putMarker(out, 0xE0, 2 + sizeof(app0));
+    out.insert(out.end(), app0, app0 + sizeof(app0));
+
+    // DQT: 8-bit tables, 0 for luminance and 1 for chrominance
+    putMarker(out, 0xDB, 2 + 65 * (gray ? 1 : 2));
+    out.push_back(0);
+    out.insert(out.end(), luq.q, luq.q + 64);
+    if (!gray) {
+        out.push_back(1);
+        out.insert(out.end(), chq.q, chq.q + 64);
+    }
+
+    // SOF0: 8-bit samples; components Y (H x V, table 0), then Cb and Cr (1x1, table 1)
+    putMarker(out, 0xC0, 8 + 3 * components);
+    out.push_back(8);
+    out.push_back(static_cast<unsigned char>(height >> 8));
+    out.push_back(static_cast<unsigned char>(height));
+    out.push_back(static_cast<unsigned char>(width >> 8));
+    out.push_back(static_cast<unsigned char>(width));
+    out.push_back(static_cast<unsigned char>(components));
+    for (int c = 0; c < components; ++c) {
+        out.push_back(static_cast<unsigned char>(c + 1));
+        out.push_back(static_cast<unsigned char>(c == 0 ? layout.H << 4 | layout.V : 0x11));
+        out.push_back(static_cast<unsigned char>(c == 0 ? 0 : 1));
+    }
+
+    // DHT: DC and AC tables 0 for luminance, 1 for chrominance
+    vector<unsigned char> dht;
+    putTable(dht, 0, 0, luDC, DC_SYMBOLS);
+    putTable(dht, 1, 0, luAC, AC_SYMBOLS);
+    if (!gray) {
+        putTable(dht, 0, 1, chDC, DC_SYMBOLS);
+        putTable(dht, 1, 1, chAC, AC_SYMBOLS);
+    }
+    putMarker(out, 0xC4, 2 + static_cast<int>(dht.size()));
+    out.insert(out.end(), dht.begin(), dht.end());
+
+    // SOS: every component in one sequential scan
+    putMarker(out, 0xDA, 6 + 2 * components);
+    out.push_back(static_cast<unsigned char>(components));
+    for (int c = 0; c < components; ++c) {
+        out.push_back(static_cast<unsigned char>(c + 1));
+        out.push_back(static_cast<unsigned char>(c == 0 ? 0x00 : 0x11));
+    }
+    out.push_back(0);                                       // Spectral selection 0-63
+    out.push_back(63);
+    out.push_back(0);                                       // No successive approximation
+
+    // The scan, with a 0 byte stuffed after every 0xFF
+    for (unsigned char b : scan) {
+        out.push_back(b);
+        if (b == 0xFF) out.push_back(0);
+    }
+    out.push_back(0xFF);
+    out.push_back(0xD9);                                    // EOI
+    return true;
+}
\ No newline at end of file
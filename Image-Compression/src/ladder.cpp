@@ -0,0 +1,44 @@
+#include "myimage.h"
+
+// Quality ladder: one encode writes the same image at several QFs (-qf A,B,C).
+// The frame is read, color converted and transformed once (DctCache); each
+// rung only quantizes the cached coefficients and entropy-codes them, and the
+// rungs run in parallel. Every file is identical to a -qf encode at its QF.
+
+// Output file of the rung at QF q: "out.bin" becomes "out.q50.bin"
+string ladderFileName(const string& outputFile, int q) {
+    size_t slash = outputFile.find_last_of("/\\");
+    size_t dot = outputFile.find_last_of('.');
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+        dot = outputFile.size();
+    return outputFile.substr(0, dot) + ".q" + to_string(q) + outputFile.substr(dot);
+}
+
+// Encode the padded gray or YUV frame at every QF of `qualities` into
+// ladderFileName(outputFile, QF), using up to `threads` threads
+bool encodeLadder(const unsigned char* frame, const ImageHeader& header, const vector<int>& qualities,
+                  const string& outputFile, int restart, bool optimize, int threads) {
+    const int pwidth = paddedSize(header.width, header.gray());
+    const int pheight = paddedSize(header.height, header.gray());
+    DctCache cache = dctCache(frame, pheight, pwidth, header.sampling);
+
+    vector<char> ok(qualities.size(), 0);
+    ThreadPool pool(min(threads > 0 ? threads : int(thread::hardware_concurrency()), int(qualities.size())));
+    pool.parallelFor(int(qualities.size()), [&](int i) {
+        ImageHeader rung = header;
+        rung.quality = qualities[i];
+        SparseCoefs coef = quantDctCache(cache, qualityScale(rung.quality));
+        ThreadPool serial(1);   // The rungs are the parallel tasks: each codes its slices in turn
+        vector<vector<unsigned char>> slices;
+        ok[i] = writeCodedFile(ladderFileName(outputFile, rung.quality), rung, coef, restart, optimize, serial,
+                               slices);
+    });
+
+    bool all = true;
+    for (size_t i = 0; i < qualities.size(); ++i) {
+        if (ok[i])
+            cout << "Compressed bitstream saved to " << ladderFileName(outputFile, qualities[i]) << endl;
+        all &= ok[i] != 0;
+    }
+    return all;
+}
\ No newline at end of file
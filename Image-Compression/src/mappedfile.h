@@ -0,0 +1,59 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <vector>
+
+// Whole-file I/O through memory mappings: the codec reads an input file and
+// writes an output file where they sit in the page cache, instead of copying
+// them through heap buffers. On systems without mmap both classes fall back
+// to a heap buffer read from or written to the file.
+
+// Read-only view of a file
+class MappedFile {
+public:
+    MappedFile() {}
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map `path`; prints a message and returns false if it cannot be read
+    bool open(const std::string& path);
+    void close();
+
+    const unsigned char* data() const { return ptr; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* ptr = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::vector<unsigned char> buffer;   // File contents when not mapped
+};
+
+// Output file of a known size, filled in place through data()
+class MappedOutput {
+public:
+    MappedOutput() {}
+    ~MappedOutput() { close(); }
+    MappedOutput(const MappedOutput&) = delete;
+    MappedOutput& operator=(const MappedOutput&) = delete;
+
+    // Create (or truncate) `path` with `size` bytes; prints a message and
+    // returns false on error
+    bool create(const std::string& path, size_t size);
+    // Finish the file; returns false if it could not be written
+    bool close();
+
+    unsigned char* data() { return ptr; }
+    size_t size() const { return length; }
+
+private:
+    unsigned char* ptr = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::string path;                    // Output file (the buffer is written to it when not mapped)
+    std::vector<unsigned char> buffer;   // File contents when not mapped
+};
+
+#endif
\ No newline at end of file
@@ -7,20 +7,234 @@
 #include <queue>
 #include <bitset>
 #include <algorithm>
+#include <atomic>
+
+#include "bitstream.h"
+#include "huffman.h"
+#include "mappedfile.h"
+#include "rans.h"
+#include "threadpool.h"
 
 #define PI 3.141592653589793
 #define SQH 0.707106781186547  /* square root of 2 */
 #define SWAP(a,b)  tempr=(a); (a) = (b); (b) = tempr
 
+// AVX2 block kernels are compiled in on x86 with GCC/Clang and chosen at run time
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2
+#endif
+
 using namespace std;
 
+// Frame layout: a gray plane, or a Y plane followed by one plane holding U
+// above V, subsampled 2x2 (4:2:0), 2x1 (4:2:2) or not at all (4:4:4)
+enum Sampling { GRAY, YUV420, YUV422, YUV444 };
+
+// Size of the U (or V) plane of a frame whose Y plane is width x height
+inline int chromaWidth(int width, Sampling s) { return s == YUV444 ? width : width / 2; }
+inline int chromaHeight(int height, Sampling s) { return s == YUV420 ? height / 2 : height; }
+
+// Random-access index entry: where the codes of a block start and the DC
+// value its DC difference is taken from
+struct IndexEntry {
+    uint64_t bit;    // Bit offset in the bitstream
+    int16_t pred;    // DC predictor
+};
+
+// Index of every `interval`-th block of each block row, so that decoding can
+// start in the middle of the bitstream
+struct BlockIndex {
+    int interval = 0;                  // Blocks between entries, 0 for no index
+    vector<vector<IndexEntry>> rows;   // Per block row, in SparseCoefs row order
+};
+
+// Fields of the compressed file header (see container.cpp)
+struct ImageHeader {
+    int width = 512;
+    int height = 512;
+    Sampling sampling = YUV420;
+    int quality = 50;   // Quality Factor 1-100
+    int restart = 0;    // MCU rows per restart slice, 0 for a single unsliced stream
+    vector<uint32_t> sliceOffsets;  // Byte offset of each slice in the bitstream
+    bool customTables = false;      // Optimized Huffman tables stored in the file
+    HuffmanSpec huffman[4];         // luDC, luAC, chDC, chAC (custom tables only)
+    EntropyCoder coder = HUFFMAN;   // Entropy coding of the bitstream
+    RansSpec rans;                  // rANS frequencies (rANS coder only)
+    BlockIndex index;               // Optional block index for region decoding
+
+    bool gray() const { return sampling == GRAY; }
+};
+
+// One nonzero AC coefficient in zigzag order
+struct RunLevel {
+    uint8_t run;     // Zero coefficients before it
+    int16_t level;   // Its value; 0 marks the end of the block
+};
+
+// Quantized coefficients of one row of 8x8 blocks: the DC of every block,
+// and the nonzero AC coefficients of all blocks as (run, level) pairs, each
+// block terminated by an end-of-block marker
+struct CoefRow {
+    vector<int16_t> dc;
+    vector<RunLevel> ac;
+};
+
+// Quantized coefficients of a padded frame, one CoefRow per block row:
+// the luminance rows, then the rows of the stacked U/V plane. A new buffer
+// holds an all-zero frame.
+struct SparseCoefs {
+    int lumaRows = 0;
+    vector<CoefRow> rows;
+
+    SparseCoefs() {}
+    SparseCoefs(int height, int width, Sampling s)
+        : lumaRows(height / 8), rows(height / 8 + (s == GRAY ? 0 : 2 * chromaHeight(height, s) / 8)) {
+        for (int r = 0; r < int(rows.size()); ++r) {
+            int blocks = r < lumaRows ? width / 8 : chromaWidth(width, s) / 8;
+            rows[r].dc.assign(blocks, 0);
+            rows[r].ac.assign(blocks, RunLevel{0, 0});
+        }
+    }
+
+    CoefRow& row(bool chroma, int by) { return rows[(chroma ? lumaRows : 0) + by]; }
+    const CoefRow& row(bool chroma, int by) const { return rows[(chroma ? lumaRows : 0) + by]; }
+};
+
+// Unquantized DCT of every block of a padded frame, in sliceRows() order,
+// so that it can be quantized at several QFs (see dctCache)
+struct DctCache {
+    int height = 0, width = 0;
+    Sampling sampling = YUV420;
+    bool fixed = false;         // Integer transform (fixed-point mode)
+    vector<float> coef;         // 64 per block, float mode
+    vector<int> coefInt;        // 64 per block, fixed-point mode
+};
+
+// One file of a batch manifest (see batch.cpp)
+struct BatchJob {
+    string input, output;
+    int width = 0, height = 0;   // Raw image size for the encoder, 0: the -w/-h options
+};
+
+// Working buffers of encode / decode, kept from one file to the next: a
+// batch run has one per worker thread, so that after the first file of a
+// given size its files are coded without reallocating them
+struct BatchContext {
+    vector<unsigned char> padded;          // Encoder: pixels padded to whole MCUs
+    vector<unsigned char> frame;           // Gray or YUV frame: encoder input, decoder output
+    SparseCoefs coef;                      // Quantized (encoder) or decoded (decoder) coefficients
+    vector<vector<unsigned char>> slices;  // Encoder: bitstreams of the restart slices
+};
+
+// Block rows [row0, row1) of the component plane starting at `offset`
+struct PlaneRows {
+    int offset;
+    int width;
+    int row0, row1;
+    bool chroma;
+};
+
+// The plane ranges of a slice (one for gray, three for color), see sliceRows()
+struct SlicePlanes {
+    PlaneRows planes[3];
+    int count = 0;
+
+    const PlaneRows* begin() const { return planes; }
+    const PlaneRows* end() const { return planes + count; }
+    size_t size() const { return count; }
+    const PlaneRows& operator[](size_t i) const { return planes[i]; }
+};
+
+// Quality of a decoded image against its original (see imageMetrics)
+struct QualityMetrics {
+    int channels = 0;
+    double mse[3] = {}, psnr[3] = {};       // Per channel
+    double ssim[3] = {}, msssim[3] = {};
+    double mseAll = 0, psnrAll = 0;         // Over all channels
+    double ssimAll = 0, msssimAll = 0;      // Mean of the channels
+};
+
+extern const unsigned char zigzagPos[64];
+extern const int luminanceQuantMatrix[8][8], chrominanceQuantMatrix[8][8];
 
 bool readRawImage(string, vector<unsigned char>&);
 void saveRawImage(string, const unsigned char*, int);
-bool saveBitmap(string, string);
-vector<unsigned char> RGB2YUV(const vector<unsigned char>&, int, int);
-vector<unsigned char> YUV2RGB(const vector<unsigned char>& , int, int);
-vector<int> quantDct2(vector<unsigned char>&, int , int, int, bool);
-vector<unsigned char> iquantDct2(vector<int>&, int , int, int, bool);
-string DCAC(vector<int>, int, int, bool);
-vector<int> ACDCdecode(string, int, int, bool);
\ No newline at end of file
+vector<unsigned char> RGB2YUV(const vector<unsigned char>&, int, int, Sampling);
+void RGB2YUV(const unsigned char*, int, int, Sampling, unsigned char*);
+vector<unsigned char> YUV2RGB(const vector<unsigned char>&, int, int, Sampling);
+void YUV2RGB(const unsigned char*, int, int, Sampling, unsigned char*);
+void YUV2RGB(const unsigned char*, int, int, Sampling, unsigned char*, int, int);
+void dct1(float*, int);
+void idct1(float*, int);
+void dct2(float**, int);
+void idct2(float**, int);
+void fdct8x8(float*);
+void idct8x8(float*);
+void fdctQuantTable(const int[8][8], int, float*);
+void idctDequantTable(const int[8][8], int, float*);
+void fdctBlock(const unsigned char*, int, float*);
+void quantBlock(const float*, const float*, int*, int);
+void fdctQuantBlock(const unsigned char*, int, const float*, int*, int);
+void idctDequantBlock(const int*, int, const float*, unsigned char*, int);
+void idctDequantDC(int, const float*, int, unsigned char*, int);
+void idctReducedTable(const int[8][8], int, float*);
+void idctDequantReduced(const int*, int, const float*, int, unsigned char*, int);
+bool setSimd(bool);
+bool simdMode();
+void fdctQuantTableInt(const int[8][8], int, int32_t*);
+void idctDequantTableInt(const int[8][8], int, int32_t*);
+void fdctBlockInt(const unsigned char*, int, int*);
+void quantBlockInt(const int*, const int32_t*, int*, int);
+void fdctQuantBlockInt(const unsigned char*, int, const int32_t*, int*, int);
+void idctDequantBlockInt(const int*, int, const int32_t*, unsigned char*, int);
+void idctDequantDCInt(int, const int32_t*, int, unsigned char*, int);
+void idctDequantReducedInt(const int*, int, const int32_t*, int, unsigned char*, int);
+void setFixedPoint(bool);
+bool fixedPointMode();
+void fitCoefs(SparseCoefs&, int, int, Sampling);
+SparseCoefs quantDct2(vector<unsigned char>&, int , int, int, Sampling);
+void quantDct2Rows(const vector<unsigned char>&, SparseCoefs&, int, int, int, Sampling, int, int);
+void quantDct2Rows(const unsigned char*, SparseCoefs&, int, int, int, Sampling, int, int);
+DctCache dctCache(const vector<unsigned char>&, int, int, Sampling);
+DctCache dctCache(const unsigned char*, int, int, Sampling);
+SparseCoefs quantDctCache(const DctCache&, int);
+vector<unsigned char> iquantDct2(const SparseCoefs&, int , int, int, Sampling, int);
+void iquantDct2Rows(const SparseCoefs&, vector<unsigned char>&, int, int, int, Sampling, int, int, int);
+void DCAC(const SparseCoefs&, int, Sampling, const EntropyTables&, BitWriter&, BlockIndex* = nullptr);
+void DCAC(const SparseCoefs&, int, Sampling, SymbolStats&);
+void DCACslice(const SparseCoefs&, int, int, Sampling, int, int, const EntropyTables&, BitWriter&, BlockIndex* = nullptr);
+void DCACslice(const SparseCoefs&, int, int, Sampling, int, int, SymbolStats&);
+uint64_t DCACbits(const SparseCoefs&, int, Sampling, const EntropyTables&);
+uint64_t DCACsliceBits(const SparseCoefs&, int, int, Sampling, int, int, const EntropyTables&);
+SparseCoefs ACDCdecode(const vector<unsigned char>&, int, int, Sampling, const EntropyTables&);
+bool ACDCdecode(const unsigned char*, size_t, SparseCoefs&, int, Sampling, const EntropyTables&);
+bool ACDCdecodeSlice(const unsigned char*, size_t, SparseCoefs&, int, int, Sampling, int, int, const EntropyTables&);
+bool ACDCdecodeBlocks(const unsigned char*, size_t, const IndexEntry&, int, CoefRow&, const HuffDecoder&, const HuffDecoder&);
+int qualityScale(int);
+int paddedSize(int, bool);
+bool validImageSize(int, int);
+int sliceCount(int, bool, int);
+SlicePlanes sliceRows(int, int, Sampling, int, int);
+size_t frameSamples(int, int, Sampling);
+BlockIndex blockIndex(int, int, int, Sampling);
+void shiftIndex(BlockIndex&, int, int, Sampling, int, int, uint64_t);
+bool writeHeader(ostream&, const ImageHeader&);
+bool writeCodedFile(const string&, ImageHeader, const SparseCoefs&, int, bool, ThreadPool&, vector<vector<unsigned char>>&);
+void writeHeader(vector<unsigned char>&, const ImageHeader&);
+int readHeader(const unsigned char*, size_t, ImageHeader&);
+int readHeader(istream&, ImageHeader&);
+void optimizeTables(ImageHeader&, const SymbolStats&);
+int targetQuality(const DctCache&, const ImageHeader&, int, bool, size_t, SparseCoefs&);
+string ladderFileName(const string&, int);
+bool encodeLadder(const unsigned char*, const ImageHeader&, const vector<int>&, const string&, int, bool, int);
+QualityMetrics imageMetrics(const unsigned char*, const unsigned char*, int, int, int, bool, int);
+EntropyTables headerTables(const ImageHeader&);
+bool writeJfif(const SparseCoefs&, const ImageHeader&, bool, vector<unsigned char>&);
+bool encodeStream(const string&, const string&, ImageHeader, int, bool, int);
+bool decodeStream(const string&, const string&, int, int);
+vector<unsigned char> decodeRegion(const unsigned char*, size_t, const ImageHeader&, int, int, int, int);
+bool readManifest(const string&, vector<BatchJob>&);
+bool runBatch(const vector<BatchJob>&, int, const function<uint64_t(const BatchJob&, BatchContext&)>&);
+vector<unsigned char> padFrame(const vector<unsigned char>&, int, int, int, int, int);
+void padFrame(const unsigned char*, int, int, int, int, int, unsigned char*);
+void cropFrame(vector<unsigned char>&, int, int, int, int);
\ No newline at end of file
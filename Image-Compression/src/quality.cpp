@@ -0,0 +1,257 @@
+#include "myimage.h"
+
+// Full-reference quality metrics of a decoded image against its original:
+// MSE and PSNR per channel and over all channels, and SSIM and MS-SSIM per
+// channel. Both images are read where they lie (interleaved RGB or gray, as
+// in the raw files), without copies. The work is split into bands of rows
+// that the threads of a pool process; each band accumulates integer sums
+// that are then added up in band order, so the results do not depend on the
+// number of threads.
+//
+// SSIM is computed over 8x8 windows placed every 4 pixels, from the integer
+// sums of 4x4 blocks (each window is 2x2 blocks), 4 blocks at a time with
+// AVX2 when available. MS-SSIM repeats it on
+// 2x2-averaged planes, up to 5 scales while the plane still holds a window.
+
+// Rows (PSNR) or window rows (SSIM) per task
+static const int BAND_ROWS = 16;
+
+// PSNR reported for identical images
+static const double PSNR_IDENTICAL = 99.0;
+
+// MS-SSIM weights of the 5 scales, finest first
+static const double MSSSIM_WEIGHTS[5] = {0.0448, 0.2856, 0.3001, 0.2363, 0.1333};
+
+#ifdef HAVE_AVX2
+int sseRowAVX2(const unsigned char*, const unsigned char*, int, int, uint64_t*);
+int blockSumsAVX2(const unsigned char*, const unsigned char*, size_t, size_t, int, int, int, uint32_t*);
+#endif
+
+// One channel of an image: `width` x `height` samples, `step` bytes apart in
+// rows of `pitch` bytes
+struct Plane {
+    const unsigned char* data;
+    int width, height;
+    size_t pitch;
+    int step;
+};
+
+// Integer sums over a group of pixels of two planes a and b
+struct WindowSums {
+    uint64_t a = 0, b = 0;
+    uint64_t ss = 0;      // a^2 + b^2
+    uint64_t ab = 0;
+
+    void add(const WindowSums& w) { a += w.a; b += w.b; ss += w.ss; ab += w.ab; }
+};
+
+// Squared differences of the `n` bytes of a row, added to sse[channel]
+static void sseRow(const unsigned char* a, const unsigned char* b, int n, int channels, uint64_t* sse) {
+    int i = 0;
+#ifdef HAVE_AVX2
+    if (simdMode())
+        i = sseRowAVX2(a, b, n, channels, sse);
+#endif
+    for (; i < n; i += channels)
+        for (int c = 0; c < channels; ++c) {
+            int d = a[i + c] - b[i + c];
+            sse[c] += uint32_t(d * d);
+        }
+}
+
+// Luminance and contrast-structure terms of a window of n pixels
+static void windowSsim(const WindowSums& w, double n, double& l, double& cs) {
+    const double C1 = (0.01 * 255) * (0.01 * 255);
+    const double C2 = (0.03 * 255) * (0.03 * 255);
+    double ma = w.a / n, mb = w.b / n;
+    double var = w.ss / n - ma * ma - mb * mb;   // Sum of both variances
+    double cov = w.ab / n - ma * mb;
+    l = (2 * ma * mb + C1) / (ma * ma + mb * mb + C1);
+    cs = (2 * cov + C2) / (var + C2);
+}
+
+// Sums of the pixels [x0, x0 + w) x [y0, y0 + h) of two planes
+static WindowSums regionSums(const Plane& pa, const Plane& pb, int x0, int y0, int w, int h) {
+    WindowSums s;
+    for (int y = y0; y < y0 + h; ++y) {
+        const unsigned char* ra = pa.data + y * pa.pitch;
+        const unsigned char* rb = pb.data + y * pb.pitch;
+        for (int x = x0; x < x0 + w; ++x) {
+            uint32_t a = ra[x * pa.step], b = rb[x * pb.step];
+            s.a += a;
+            s.b += b;
+            s.ss += a * a + b * b;
+            s.ab += a * b;
+        }
+    }
+    return s;
+}
+
+// Sums of the 4x4 blocks of block row `by`
+static void blockRow(const Plane& pa, const Plane& pb, int by, vector<WindowSums>& sums) {
+    int bx = 0;
+#ifdef HAVE_AVX2
+    if (simdMode() && pa.step == pb.step) {
+        uint32_t vec[4 * 64];   // a, b, ss, ab of up to 64 blocks per call
+        while (bx < int(sums.size())) {
+            int n = min(int(sums.size()) - bx, 64);
+            int done = blockSumsAVX2(pa.data + by * 4 * pa.pitch + size_t(bx) * 4 * pa.step,
+                                     pb.data + by * 4 * pb.pitch + size_t(bx) * 4 * pb.step, pa.pitch, pb.pitch,
+                                     pa.step, pa.width - bx * 4, n, vec);
+            for (int k = 0; k < done; ++k) {
+                WindowSums& w = sums[bx + k];
+                w.a = vec[4 * k];
+                w.b = vec[4 * k + 1];
+                w.ss = vec[4 * k + 2];
+                w.ab = vec[4 * k + 3];
+            }
+            bx += done;
+            if (done < n)
+                break;
+        }
+    }
+#endif
+    for (; bx < int(sums.size()); ++bx)
+        sums[bx] = regionSums(pa, pb, bx * 4, by * 4, 4, 4);
+}
+
+// Mean SSIM and mean contrast-structure term over the windows of two planes
+static void planeSsim(const Plane& pa, const Plane& pb, ThreadPool& pool, double& ssim, double& cs) {
+    const int bw = pa.width / 4, bh = pa.height / 4;
+    if (bw < 2 || bh < 2) {   // No whole window: the plane is one window
+        double l;
+        windowSsim(regionSums(pa, pb, 0, 0, pa.width, pa.height), double(pa.width) * pa.height, l, cs);
+        ssim = l * cs;
+        return;
+    }
+
+    const int rows = bh - 1, cols = bw - 1;   // Windows
+    const int bands = (rows + BAND_ROWS - 1) / BAND_ROWS;
+    vector<double> bandSsim(bands), bandCs(bands);
+    pool.parallelFor(bands, [&](int k) {
+        const int r0 = k * BAND_ROWS, r1 = min(rows, r0 + BAND_ROWS);
+        vector<WindowSums> above(bw), below(bw);
+        blockRow(pa, pb, r0, above);
+        double sumSsim = 0, sumCs = 0;
+        for (int r = r0; r < r1; ++r) {
+            blockRow(pa, pb, r + 1, below);
+            for (int x = 0; x < cols; ++x) {
+                WindowSums w = above[x];
+                w.add(above[x + 1]);
+                w.add(below[x]);
+                w.add(below[x + 1]);
+                double l, c;
+                windowSsim(w, 64, l, c);
+                sumSsim += l * c;
+                sumCs += c;
+            }
+            swap(above, below);
+        }
+        bandSsim[k] = sumSsim;
+        bandCs[k] = sumCs;
+    });
+
+    double sumSsim = 0, sumCs = 0;
+    for (int k = 0; k < bands; ++k) {
+        sumSsim += bandSsim[k];
+        sumCs += bandCs[k];
+    }
+    ssim = sumSsim / (double(rows) * cols);
+    cs = sumCs / (double(rows) * cols);
+}
+
+// Plane `p` averaged over 2x2 pixels, with rounding
+static vector<unsigned char> halvePlane(const Plane& p, ThreadPool& pool) {
+    const int w = p.width / 2, h = p.height / 2;
+    vector<unsigned char> out(size_t(w) * h);
+    pool.parallelFor((h + BAND_ROWS - 1) / BAND_ROWS, [&](int k) {
+        for (int y = k * BAND_ROWS; y < min(h, (k + 1) * BAND_ROWS); ++y) {
+            const unsigned char* r0 = p.data + 2 * y * p.pitch;
+            const unsigned char* r1 = r0 + p.pitch;
+            for (int x = 0; x < w; ++x) {
+                size_t i = size_t(2 * x) * p.step;
+                out[size_t(y) * w + x] =
+                    static_cast<unsigned char>((r0[i] + r0[i + p.step] + r1[i] + r1[i + p.step] + 2) >> 2);
+            }
+        }
+    });
+    return out;
+}
+
+// SSIM and MS-SSIM of one channel. Scales are added while the halved plane
+// still holds a window; the weights of the scales used are renormalized.
+static void channelSsim(Plane pa, Plane pb, ThreadPool& pool, bool multiscale, double& ssim, double& msssim) {
+    double cs[5], last = 0;
+    int scales = 0;
+    vector<unsigned char> halfA, halfB;
+    for (;;) {
+        planeSsim(pa, pb, pool, last, cs[scales]);
+        if (scales == 0)
+            ssim = last;
+        ++scales;
+        if (!multiscale || scales == 5 || pa.width / 2 < 8 || pa.height / 2 < 8)
+            break;
+
+        halfA = halvePlane(pa, pool);
+        halfB = halvePlane(pb, pool);
+        pa = {halfA.data(), pa.width / 2, pa.height / 2, size_t(pa.width / 2), 1};
+        pb = {halfB.data(), pb.width / 2, pb.height / 2, size_t(pb.width / 2), 1};
+    }
+    if (!multiscale) {
+        msssim = 0;
+        return;
+    }
+
+    double weights = 0;
+    for (int i = 0; i < scales; ++i)
+        weights += MSSSIM_WEIGHTS[i];
+    msssim = pow(max(last, 0.0), MSSSIM_WEIGHTS[scales - 1] / weights);
+    for (int i = 0; i < scales - 1; ++i)
+        msssim *= pow(max(cs[i], 0.0), MSSSIM_WEIGHTS[i] / weights);
+}
+
+static double psnrOf(double mse) {
+    return mse == 0 ? PSNR_IDENTICAL : 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+// Compare `decoded` against `original`, both width x height pixels of
+// `channels` (1 or 3) interleaved bytes. `structural` adds SSIM and MS-SSIM;
+// `threads` <= 0 uses all cores.
+QualityMetrics imageMetrics(const unsigned char* original, const unsigned char* decoded, int width, int height,
+                            int channels, bool structural, int threads) {
+    QualityMetrics m;
+    m.channels = channels;
+    ThreadPool pool(threads);
+    const size_t pitch = size_t(width) * channels;
+
+    // Squared errors, per band of rows and channel
+    const int bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+    vector<uint64_t> bandSse(size_t(bands) * channels);
+    pool.parallelFor(bands, [&](int k) {
+        for (int y = k * BAND_ROWS; y < min(height, (k + 1) * BAND_ROWS); ++y)
+            sseRow(original + y * pitch, decoded + y * pitch, int(pitch), channels, &bandSse[size_t(k) * channels]);
+    });
+
+    uint64_t total = 0;
+    for (int c = 0; c < channels; ++c) {
+        uint64_t sse = 0;
+        for (int k = 0; k < bands; ++k)
+            sse += bandSse[size_t(k) * channels + c];
+        total += sse;
+        m.mse[c] = double(sse) / (double(width) * height);
+        m.psnr[c] = psnrOf(m.mse[c]);
+    }
+    m.mseAll = double(total) / (double(width) * height * channels);
+    m.psnrAll = psnrOf(m.mseAll);
+
+    if (structural && width > 0 && height > 0) {
+        for (int c = 0; c < channels; ++c) {
+            Plane pa = {original + c, width, height, pitch, channels};
+            Plane pb = {decoded + c, width, height, pitch, channels};
+            channelSsim(pa, pb, pool, true, m.ssim[c], m.msssim[c]);
+            m.ssimAll += m.ssim[c] / channels;
+            m.msssimAll += m.msssim[c] / channels;
+        }
+    }
+    return m;
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+/* AVX2 versions of the squared error row and SSIM block kernels in quality.cpp */
+/* 48 bytes (16 RGB or 48 gray pixels) are handled per step: each 16-byte
+chunk is widened to 16-bit differences, squared, and widened again to 32-bit
+lanes that each keep the sum of one of the 48 byte positions. As 48 is a
+multiple of 3, every lane belongs to a single channel, and the lanes are
+folded into the channel sums at the end, so the result is the exact integer
+sum of the scalar code. The kernel returns the number of bytes done; the
+scalar code finishes the row.
+
+The SSIM kernel sums the 4x4 blocks of a block row 16 pixels (4 blocks) at a
+time. RGB samples are gathered from 48 bytes with byte shuffles. The pixel
+sums of the 4 rows stay in 16-bit lanes; the squares and products are added
+in pairs of neighbouring pixels into 32-bit lanes (madd), which never mix two
+blocks, and a horizontal add completes each block. A block holds at most
+2 * 16 * 255^2 in its 32-bit sums, so they are the exact scalar sums. */
+
+#include "myimage.h"
+
+#ifdef HAVE_AVX2
+
+#include <immintrin.h>
+
+#define AVX2_FN __attribute__((target("avx2")))
+
+/* Steps between two folds, well below the 32-bit lane limit (65025 per add) */
+#define FOLD_STEPS 4096
+
+/* Squared differences of the 16 bytes at a and b as two vectors of eight 32-bit lanes */
+AVX2_FN static inline void squares(const unsigned char *a, const unsigned char *b, __m256i *lo, __m256i *hi)
+{
+  __m256i d = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)a)),
+                               _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)b)));
+  __m256i sq = _mm256_mullo_epi16(d, d);   /* At most 255^2: fits unsigned 16-bit */
+  *lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(sq));
+  *hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(sq, 1));
+}
+
+/* Add the lanes of acc (byte positions 0-47) to sse[position % channels] and clear them */
+AVX2_FN static inline void fold(__m256i *acc, int channels, uint64_t *sse)
+{
+  uint32_t lanes[48];
+  for (int k = 0; k < 6; ++k) {
+    _mm256_storeu_si256((__m256i *)(lanes + 8 * k), acc[k]);
+    acc[k] = _mm256_setzero_si256();
+  }
+  for (int p = 0; p < 48; ++p)
+    sse[p % channels] += lanes[p];
+}
+
+AVX2_FN int sseRowAVX2(const unsigned char *a, const unsigned char *b, int n, int channels, uint64_t *sse)
+{
+  __m256i acc[6];
+  for (int k = 0; k < 6; ++k)
+    acc[k] = _mm256_setzero_si256();
+
+  int i = 0, steps = 0;
+  for (; i + 48 <= n; i += 48) {
+    for (int k = 0; k < 3; ++k) {
+      __m256i lo, hi;
+      squares(a + i + 16 * k, b + i + 16 * k, &lo, &hi);
+      acc[2 * k] = _mm256_add_epi32(acc[2 * k], lo);
+      acc[2 * k + 1] = _mm256_add_epi32(acc[2 * k + 1], hi);
+    }
+    if (++steps == FOLD_STEPS) {
+      fold(acc, channels, sse);
+      steps = 0;
+    }
+  }
+  fold(acc, channels, sse);
+  return i;
+}
+
+/* Shuffles gathering every third byte of 48 (the 16 samples of one RGB
+channel) from its three 16-byte parts */
+static const signed char GATHER3[3][16] = {
+  {0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+  {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13},
+};
+
+/* The 16 samples at p, `step` (1 or 3) bytes apart, widened to 16 bits */
+AVX2_FN static inline __m256i samples16(const unsigned char *p, int step)
+{
+  if (step == 1)
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p));
+  __m128i v = _mm_or_si128(
+      _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p),
+                                    _mm_loadu_si128((const __m128i *)GATHER3[0])),
+                   _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)),
+                                    _mm_loadu_si128((const __m128i *)GATHER3[1]))),
+      _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)),
+                       _mm_loadu_si128((const __m128i *)GATHER3[2])));
+  return _mm256_cvtepu8_epi16(v);
+}
+
+/* Sums a, b, a^2 + b^2 and ab of the 4x4 blocks of 4 rows of two planes,
+`pitchA` and `pitchB` bytes apart, with samples `step` bytes apart in rows of
+`width` samples. Writes 4 values per block to sums and returns the number of
+blocks done, a multiple of 4; the scalar code does the others. */
+AVX2_FN int blockSumsAVX2(const unsigned char *a, const unsigned char *b, size_t pitchA, size_t pitchB, int step,
+                          int width, int blocks, uint32_t *sums)
+{
+  if (step != 1 && step != 3)
+    return 0;
+  const __m256i ones = _mm256_set1_epi16(1);
+  int bx = 0;
+  /* A group reads 16 * step bytes: with RGB, two past its last sample */
+  for (; bx + 4 <= blocks && 4 * bx + 16 + (step > 1) <= width; bx += 4) {
+    __m256i sa = _mm256_setzero_si256(), sb = _mm256_setzero_si256();
+    __m256i ss = _mm256_setzero_si256(), ab = _mm256_setzero_si256();
+    for (int y = 0; y < 4; ++y) {
+      __m256i va = samples16(a + y * pitchA + size_t(4 * bx) * step, step);
+      __m256i vb = samples16(b + y * pitchB + size_t(4 * bx) * step, step);
+      sa = _mm256_add_epi16(sa, va);
+      sb = _mm256_add_epi16(sb, vb);
+      ss = _mm256_add_epi32(ss, _mm256_add_epi32(_mm256_madd_epi16(va, va), _mm256_madd_epi16(vb, vb)));
+      ab = _mm256_add_epi32(ab, _mm256_madd_epi16(va, vb));
+    }
+    /* Per 128-bit half (2 blocks): the a sums, the b sums; then ss, ab */
+    uint32_t pix[8], prod[8];
+    _mm256_storeu_si256((__m256i *)pix,
+                        _mm256_hadd_epi32(_mm256_madd_epi16(sa, ones), _mm256_madd_epi16(sb, ones)));
+    _mm256_storeu_si256((__m256i *)prod, _mm256_hadd_epi32(ss, ab));
+    for (int k = 0; k < 4; ++k) {
+      int lane = 4 * (k / 2) + k % 2;
+      uint32_t *out = sums + 4 * (bx + k);
+      out[0] = pix[lane];
+      out[1] = pix[lane + 2];
+      out[2] = prod[lane];
+      out[3] = prod[lane + 2];
+    }
+  }
+  return bx;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "myimage.h"
+
+// rANS models: building the per-file frequencies from the symbol counts of a
+// statistics pass, and the coding tables from the stored frequencies. The
+// coder itself is in rans.h.
+
+// Scale symbol counts to frequencies adding up to 2^RANS_SCALE_BITS, every
+// counted symbol keeping at least 1. Empty for a context with no symbols.
+static vector<uint16_t> normalizeCounts(const uint32_t* count, int size) {
+    const int total = 1 << RANS_SCALE_BITS;
+    uint64_t sum = 0;
+    for (int s = 0; s < size; ++s)
+        sum += count[s];
+    if (sum == 0)
+        return {};
+
+    vector<uint16_t> freq(size, 0);
+    int used = 0, largest = 0;
+    for (int s = 0; s < size; ++s) {
+        if (count[s] == 0)
+            continue;
+        freq[s] = static_cast<uint16_t>(max<uint64_t>(1, (uint64_t(count[s]) * total + sum / 2) / sum));
+        used += freq[s];
+        if (count[s] > count[largest])
+            largest = s;
+    }
+
+    // Rounding leaves the total a little off: give the difference to the
+    // most frequent symbol, or take it from the largest frequencies
+    if (used < total)
+        freq[largest] += static_cast<uint16_t>(total - used);
+    while (used > total) {
+        int s = static_cast<int>(max_element(freq.begin(), freq.end()) - freq.begin());
+        int d = min(used - total, freq[s] - 1);
+        freq[s] -= static_cast<uint16_t>(d);
+        used -= d;
+    }
+    return freq;
+}
+
+RansSpec buildRansSpec(const SymbolStats& st, bool gray) {
+    RansSpec spec;
+    spec.freq[dcContext(false)] = normalizeCounts(st.luDC, DC_SYMBOLS);
+    for (int b = 0; b < AC_BANDS; ++b)
+        spec.freq[acContext(false, b)] = normalizeCounts(st.luBand[b], AC_SYMBOLS);
+    if (!gray) {
+        spec.freq[dcContext(true)] = normalizeCounts(st.chDC, DC_SYMBOLS);
+        for (int b = 0; b < AC_BANDS; ++b)
+            spec.freq[acContext(true, b)] = normalizeCounts(st.chBand[b], AC_SYMBOLS);
+    }
+    return spec;
+}
+
+// Whether `freq` can be the table of context `ctx`: empty, or one frequency
+// per symbol adding up to 2^RANS_SCALE_BITS
+bool validRansContext(const vector<uint16_t>& freq, int ctx) {
+    if (freq.empty())
+        return true;
+    uint32_t sum = 0;
+    for (uint16_t f : freq)
+        sum += f;
+    return freq.size() == size_t(contextSymbols(ctx)) && sum == (1u << RANS_SCALE_BITS);
+}
+
+RansModel::RansModel(const RansSpec& spec) {
+    for (int k = 0; k < RANS_CONTEXTS; ++k) {
+        const vector<uint16_t>& freq = spec.freq[k];
+        if (freq.empty())
+            continue;
+        RansContext& c = ctx[k];
+        const int size = contextSymbols(k);
+        c.start.assign(size, 0);
+        c.freq.assign(freq.begin(), freq.end());
+        c.cost.assign(size, 0);
+        c.symbol.resize(1 << RANS_SCALE_BITS);
+        uint32_t start = 0;
+        for (int s = 0; s < size; ++s) {
+            c.start[s] = static_cast<uint16_t>(start);
+            if (freq[s] == 0)
+                continue;
+            c.cost[s] = static_cast<uint16_t>(lround(256 * (RANS_SCALE_BITS - log2(freq[s]))));
+            fill(c.symbol.begin() + start, c.symbol.begin() + start + freq[s], static_cast<uint8_t>(s));
+            start += freq[s];
+        }
+    }
+}
+
+EntropyTables::EntropyTables(const RansSpec& spec) : coder(RANS), rans(make_shared<RansModel>(spec)) {}
\ No newline at end of file
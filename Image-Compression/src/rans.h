@@ -0,0 +1,175 @@
+#ifndef RANS_H
+#define RANS_H
+
+#include <cstdint>
+#include <vector>
+
+#include "bitstream.h"
+#include "huffman.h"
+
+// Interleaved rANS coder, the alternative entropy backend to Huffman coding
+// (EntropyCoder RANS). The DC and AC symbols of encodeRows() are coded with
+// static frequencies stored in the file header, normalized to
+// 2^RANS_SCALE_BITS, and their magnitude bits as uniform symbols of 2^cat
+// values. Each symbol together with its magnitude bits goes to one of
+// RANS_STATES independent 32-bit states in turn, so consecutive symbols
+// decode without waiting on each other. The states renormalize a byte at a
+// time into one shared byte stream, which starts with their final values.
+
+const int RANS_SCALE_BITS = 12;
+const uint32_t RANS_LOW = 1u << 23;   // Lower bound of a normalized state
+const int RANS_STATES = 4;            // Power of two
+
+// Contexts: the DC symbols of luminance and chrominance, then the AC symbols
+// of each, split by zigzag band (acBand)
+const int RANS_CONTEXTS = 2 + 2 * AC_BANDS;
+
+inline int dcContext(bool chroma) { return chroma ? 1 : 0; }
+inline int acContext(bool chroma, int band) { return 2 + (chroma ? AC_BANDS : 0) + band; }
+inline int contextSymbols(int ctx) { return ctx < 2 ? DC_SYMBOLS : AC_SYMBOLS; }
+inline bool chromaContext(int ctx) { return ctx == 1 || ctx >= 2 + AC_BANDS; }
+
+// Normalized symbol frequencies of every context, as stored in the file:
+// freq[ctx][symbol], 0 for an unused symbol. The frequencies of a used
+// context add up to 2^RANS_SCALE_BITS; an unused context is empty.
+struct RansSpec {
+    std::vector<uint16_t> freq[RANS_CONTEXTS];
+};
+
+// Coding tables of one context
+struct RansContext {
+    std::vector<uint16_t> start, freq;   // Cumulative and own frequency of each symbol
+    std::vector<uint8_t> symbol;         // Symbol of each of the 2^RANS_SCALE_BITS slots (empty: unused context)
+    std::vector<uint16_t> cost;          // Code length of each symbol in 1/256 bit
+};
+
+struct RansModel {
+    RansContext ctx[RANS_CONTEXTS];
+
+    explicit RansModel(const RansSpec& spec);
+};
+
+RansSpec buildRansSpec(const SymbolStats& st, bool gray);
+bool validRansContext(const std::vector<uint16_t>& freq, int ctx);
+
+// Collects the symbols of a bitstream, then codes them in reverse order (as
+// rANS requires) when the stream is finished
+class RansEncoder {
+public:
+    explicit RansEncoder(const RansModel& m) : model(m) {}
+
+    // Queue symbol `symbol` of context `ctx` followed by the low `cat` bits of `bits`
+    inline void put(int ctx, int symbol, int cat, uint32_t bits) {
+        ops.push_back(uint32_t(ctx) << 23 | uint32_t(symbol) << 15 | uint32_t(cat) << 11 | (bits & 0x7FF));
+    }
+
+    // Code the queued symbols and write the stream to `bw`, which must be on
+    // a byte boundary
+    void finish(BitWriter& bw) {
+        out.resize(2 * 2 * ops.size() + 4 * RANS_STATES);   // At most 2 bytes per coding step
+        unsigned char* const end = out.data() + out.size();
+        unsigned char* p = end;
+        uint32_t x[RANS_STATES];
+        for (uint32_t& s : x) s = RANS_LOW;
+
+        for (size_t i = ops.size(); i-- > 0;) {
+            const uint32_t op = ops[i];
+            const int cat = (op >> 11) & 15;
+            const RansContext& c = model.ctx[op >> 23];
+            const int symbol = (op >> 15) & 255;
+            uint32_t& s = x[i & (RANS_STATES - 1)];
+
+            // The magnitude bits are decoded last, so they are coded first
+            if (cat) {
+                const uint32_t max = (RANS_LOW >> cat) << 8;
+                while (s >= max) { *--p = static_cast<unsigned char>(s); s >>= 8; }
+                s = (s << cat) | (op & ((1u << cat) - 1));
+            }
+            const uint32_t freq = c.freq[symbol];
+            const uint32_t max = ((RANS_LOW >> RANS_SCALE_BITS) << 8) * freq;
+            while (s >= max) { *--p = static_cast<unsigned char>(s); s >>= 8; }
+            s = ((s / freq) << RANS_SCALE_BITS) + (s % freq) + c.start[symbol];
+        }
+
+        // Final states, state 0 first
+        for (int k = RANS_STATES; k-- > 0;) {
+            p -= 4;
+            for (int b = 0; b < 4; ++b) p[b] = static_cast<unsigned char>(x[k] >> (8 * b));
+        }
+        for (; p < end; ++p) bw.put(*p, 8);
+        ops.clear();
+    }
+
+private:
+    const RansModel& model;
+    std::vector<uint32_t> ops;         // Context, symbol, magnitude size and bits of each symbol
+    std::vector<unsigned char> out;    // Stream, filled from the end
+};
+
+// Decodes the symbols of a RansEncoder stream in order. Reads past the end
+// of the buffer return zero bytes and stop the decoding: every get() after
+// an invalid start state or such a read returns -1. finished() tells whether
+// the stream was consumed exactly as it was coded.
+class RansDecoder {
+public:
+    RansDecoder(const unsigned char* data, size_t size) : p(data), end(data + size) {
+        for (uint32_t& s : x) {
+            s = 0;
+            for (int b = 0; b < 4; ++b) s |= uint32_t(next()) << (8 * b);
+            if (s < RANS_LOW) {        // Not a valid final state
+                s = RANS_LOW;
+                bad = true;
+            }
+        }
+    }
+
+    // Next symbol of context `c` (-1 for an unused context or a bad stream)
+    inline int get(const RansContext& c) {
+        if (bad || c.symbol.empty()) return -1;
+        cur = &x[n++ & (RANS_STATES - 1)];
+        uint32_t& s = *cur;
+        const uint32_t slot = s & ((1u << RANS_SCALE_BITS) - 1);
+        const int symbol = c.symbol[slot];
+        s = c.freq[symbol] * (s >> RANS_SCALE_BITS) + slot - c.start[symbol];
+        renorm(s);
+        return symbol;
+    }
+
+    // The `cat` magnitude bits that follow the last symbol
+    inline uint32_t getBits(int cat) {
+        if (cat == 0) return 0;
+        uint32_t& s = *cur;
+        const uint32_t bits = s & ((1u << cat) - 1);
+        s >>= cat;
+        renorm(s);
+        return bits;
+    }
+
+    // True if every state is back at its start value and all bytes, and no
+    // more, were read
+    bool finished() const {
+        for (uint32_t s : x)
+            if (s != RANS_LOW) return false;
+        return !bad && p == end;
+    }
+
+private:
+    inline unsigned char next() {
+        if (p < end) return *p++;
+        bad = true;
+        return 0;
+    }
+
+    inline void renorm(uint32_t& s) {
+        while (s < RANS_LOW) s = (s << 8) | next();
+    }
+
+    const unsigned char* p;
+    const unsigned char* end;
+    uint32_t x[RANS_STATES];
+    uint32_t* cur = x;
+    size_t n = 0;           // Symbols decoded
+    bool bad = false;       // Invalid start state or read past the end
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include <sstream>
+
+#include "myimage.h"
+
+// Rate control for a target file size (encode -target-bytes). The frame is
+// transformed once (DctCache); every QF trial only quantizes the cached
+// coefficients and adds up the length of their codes, which for Huffman
+// gives the exact size of the file without writing it. rANS codes are
+// priced from rounded symbol costs and can be a few bytes off, so the QF
+// chosen for rANS is checked by coding it for real. qualityScale() makes the
+// quantization finer as the QF goes down, so the file grows as the QF goes
+// down, and the lowest (best) QF that fits is found by bisection in at most
+// 7 trials.
+
+// Lowest QF whose quantization steps are all at least 1, so that every
+// level fits the entropy coders' symbols unclipped (see MAX_LEVEL)
+static int lowestQuality() {
+    int qmin = 255;
+    for (int i = 0; i < 64; ++i)
+        qmin = min({qmin, luminanceQuantMatrix[i / 8][i % 8], chrominanceQuantMatrix[i / 8][i % 8]});
+    int QF = 1;
+    while (qualityScale(QF) > 100 * qmin)
+        ++QF;
+    return QF;
+}
+
+// Size in bytes of the file that encodes `coef` with this header, restart
+// interval and table mode, as encode.cpp writes it. With `exact`, a rANS
+// bitstream is coded into a scratch buffer instead of estimated.
+static size_t encodedSize(const SparseCoefs& coef, ImageHeader header, int height, int width,
+                          int restart, bool optimize, bool exact = false) {
+    const Sampling sampling = header.sampling;
+    const bool gray = sampling == GRAY;
+    const int mcuRows = height / (gray ? 8 : 16);
+    const int nslices = sliceCount(height, gray, restart);
+
+    if (optimize) {
+        SymbolStats stats;
+        if (restart == 0)
+            DCAC(coef, height, sampling, stats);
+        else
+            for (int s = 0; s < nslices; ++s)
+                DCACslice(coef, height, width, sampling, s * restart, min(mcuRows, (s + 1) * restart), stats);
+        optimizeTables(header, stats);
+    }
+    EntropyTables tables = headerTables(header);
+
+    // Every slice (or the one bitstream) is padded to a whole byte
+    uint64_t bytes = 0;
+    if (exact && tables.coder == RANS) {
+        vector<unsigned char> scratch;
+        for (int s = 0; s < nslices; ++s) {
+            BitWriter bw(scratch);
+            if (restart == 0) {
+                DCAC(coef, height, sampling, tables, bw);
+                bw.flush();
+            } else {
+                DCACslice(coef, height, width, sampling, s * restart, min(mcuRows, (s + 1) * restart), tables, bw);
+            }
+            bytes += scratch.size();
+            scratch.clear();
+        }
+    } else if (restart == 0) {
+        bytes = (DCACbits(coef, height, sampling, tables) + 7) / 8;
+    } else {
+        for (int s = 0; s < nslices; ++s)
+            bytes += (DCACsliceBits(coef, height, width, sampling, s * restart,
+                                    min(mcuRows, (s + 1) * restart), tables) + 7) / 8;
+    }
+    if (restart > 0) {
+        header.restart = restart;
+        header.sliceOffsets.assign(nslices, 0);
+    }
+
+    ostringstream os;
+    writeHeader(os, header);
+    return os.str().size() + bytes;
+}
+
+// Quality factor with the best image quality, i.e. the lowest one, whose
+// file is at most `targetBytes` long, or 0 if none is small enough. Only
+// QFs from lowestQuality() to 99 are tried: below, levels would be clipped,
+// and QF 100 has a zero quantization scale. `coef` receives the
+// coefficients quantized at that QF, ready for the entropy coder.
+int targetQuality(const DctCache& cache, const ImageHeader& header, int restart, bool optimize,
+                  size_t targetBytes, SparseCoefs& coef) {
+    ImageHeader trial = header;
+    int lo = lowestQuality(), hi = 99, best = 0;
+    size_t bestSize = 0, lastSize = 0;
+    while (lo <= hi) {
+        int q = (lo + hi) / 2;
+        SparseCoefs c = quantDctCache(cache, qualityScale(q));
+        trial.quality = q;
+        size_t size = encodedSize(c, trial, cache.height, cache.width, restart, optimize);
+        if (size <= targetBytes) {
+            best = q;
+            bestSize = size;
+            coef = move(c);
+            hi = q - 1;
+        } else {
+            lo = q + 1;
+            lastSize = size;   // Ends at QF 99 when nothing fits
+        }
+    }
+
+    // The rANS sizes above are estimates: code the chosen QF for real, and
+    // move up while its file is over the target
+    while (best > 0 && header.coder == RANS) {
+        trial.quality = best;
+        bestSize = encodedSize(coef, trial, cache.height, cache.width, restart, optimize, true);
+        if (bestSize <= targetBytes)
+            break;
+        lastSize = bestSize;
+        best = best < 99 ? best + 1 : 0;
+        if (best > 0)
+            coef = quantDctCache(cache, qualityScale(best));
+    }
+
+    if (best == 0) {
+        cerr << "No quality factor fits in " << targetBytes << " bytes (QF 99 needs " << lastSize << ").\n";
+        return 0;
+    }
+    cout << "Target " << targetBytes << " bytes: QF " << best << ", " << bestSize << " bytes" << endl;
+    return best;
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#include "myimage.h"
+
+// Region-of-interest decoding: files encoded with a block index (-index N)
+// store, every N blocks of every block row, where the block's codes start
+// in the bitstream and the DC value it is predicted from. A rectangle is
+// decoded by starting each block row it covers at the closest index entry
+// to its left, so the work grows with the size of the rectangle (plus up
+// to N - 1 skipped blocks per row), not with the size of the image.
+
+// Decode the x, y, w x h rectangle of the image from the bitstream `data`
+// (the file without its header). Returns the RGB (or gray) pixels of the
+// rectangle, or an empty vector if the file has no block index, the
+// rectangle is not inside the image or its blocks cannot be decoded.
+vector<unsigned char> decodeRegion(const unsigned char* data, size_t size, const ImageHeader& header,
+                                   int x, int y, int w, int h) {
+    if (header.index.interval <= 0) {
+        cerr << "The file has no block index (encode it with -index N).\n";
+        return {};
+    }
+    if (x < 0 || y < 0 || w <= 0 || h <= 0 || x > header.width - w || y > header.height - h) {
+        cerr << "Region outside the image.\n";
+        return {};
+    }
+
+    const Sampling sampling = header.sampling;
+    const bool gray = sampling == GRAY;
+    const int channels = gray ? 1 : 3;
+    const int mcu = gray ? 8 : 16;
+    const int pwidth = paddedSize(header.width, gray);
+    const int pheight = paddedSize(header.height, gray);
+    const int interval = header.index.interval;
+    EntropyTables tables = headerTables(header);
+
+    // The MCUs covering the rectangle form a small padded frame
+    const int mx0 = x / mcu, mx1 = (x + w + mcu - 1) / mcu;
+    const int my0 = y / mcu, my1 = (y + h + mcu - 1) / mcu;
+    const int rwidth = (mx1 - mx0) * mcu, rheight = (my1 - my0) * mcu;
+    SparseCoefs coef(rheight, rwidth, sampling);
+
+    // Pair up the block rows of every plane in the image and in the small frame
+    SlicePlanes frameRows = sliceRows(pheight, pwidth, sampling, my0, my1);
+    SlicePlanes regionRows = sliceRows(rheight, rwidth, sampling, 0, my1 - my0);
+    const int chromaBlocks = chromaWidth(mcu, sampling) / 8;   // Chroma block columns per MCU
+    bool ok = true;
+    for (size_t p = 0; p < frameRows.size(); ++p) {
+        const PlaneRows& f = frameRows[p];
+        const int bx0 = mx0 * (f.chroma ? chromaBlocks : (gray ? 1 : 2));   // First block column
+        const HuffDecoder& DC = f.chroma ? tables.dChDC : tables.dLuDC;
+        const HuffDecoder& AC = f.chroma ? tables.dChAC : tables.dLuAC;
+        for (int r = 0; r < f.row1 - f.row0; ++r) {
+            const IndexEntry& at = header.index.rows[(f.chroma ? pheight / 8 : 0) + f.row0 + r][bx0 / interval];
+            CoefRow& row = coef.row(f.chroma, regionRows[p].row0 + r);
+            ok &= ACDCdecodeBlocks(data, size, at, bx0 % interval, row, DC, AC);
+        }
+    }
+    if (!ok) {
+        cerr << "Some blocks of the region could not be decoded.\n";
+        return {};
+    }
+
+    // Reconstruct the small frame and cut out the rectangle
+    vector<unsigned char> frame = iquantDct2(coef, qualityScale(header.quality), rheight, rwidth, sampling, 1);
+    if (!gray)
+        frame = YUV2RGB(frame, rwidth, rheight, sampling);
+
+    vector<unsigned char> out(size_t(w) * h * channels);
+    for (int r = 0; r < h; ++r)
+        memcpy(&out[size_t(r) * w * channels],
+               &frame[(size_t(y - my0 * mcu + r) * rwidth + (x - mx0 * mcu)) * channels], size_t(w) * channels);
+    return out;
+}
\ No newline at end of file
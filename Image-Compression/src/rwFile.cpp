@@ -1,5 +1,17 @@
 #include "myimage.h"
 
+// Memory mappings are used on POSIX systems
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef __APPLE__
+#define HAVE_FALLOCATE   // posix_fallocate (not on macOS)
+#endif
+#endif
+
 void saveRawImage(string filename, const unsigned char* img, int size) {
     ofstream ofs(filename, ios::binary);
     if (!ofs) {
@@ -30,22 +42,104 @@ bool readRawImage(string filename, vector<unsigned char>& img) {
     return true;
 }
 
-bool saveBitmap(string bitstream, string outputFile){
-    ofstream fout(outputFile, ios::binary);
-    if (!fout) {
-        cerr << "Cannot open output file.\n";
-        return false;
+bool MappedFile::open(const string& filename) {
+    close();
+#ifdef HAVE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        length = size_t(st.st_size);
+        void* p = length ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (p != MAP_FAILED) {
+            madvise(p, length, MADV_SEQUENTIAL);
+            ptr = static_cast<const unsigned char*>(p);
+            mapped = true;
+        }
     }
-
-    // Pad to 8 bits and write bytes to file
-    while (bitstream.size() % 8 != 0) bitstream += '0';
-    for (size_t i = 0; i < bitstream.size(); i += 8) {
-        bitset<8> byte(bitstream.substr(i, 8));
-        unsigned char b = static_cast<unsigned char>(byte.to_ulong());
-        fout.write(reinterpret_cast<char*>(&b), 1);
+    if (fd >= 0)
+        ::close(fd);
+    if (mapped || (fd >= 0 && length == 0))
+        return true;
+#endif
+    // No mapping: read the file into the buffer
+    ifstream file(filename, ios::binary);
+    if (!file) {
+        cerr << "Failed to open " << filename << endl;
+        return false;
     }
+    buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    ptr = buffer.data();
+    length = buffer.size();
+    return true;
+}
 
-    fout.close();
+void MappedFile::close() {
+#ifdef HAVE_MMAP
+    if (mapped)
+        munmap(const_cast<unsigned char*>(ptr), length);
+#endif
+    mapped = false;
+    ptr = nullptr;
+    length = 0;
+    buffer.clear();
+}
 
+bool MappedOutput::create(const string& filename, size_t size) {
+    close();
+    length = size;
+#ifdef HAVE_MMAP
+    int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Error opening file for writing: " << filename << endl;
+        return false;
+    }
+    // Reserve the blocks before mapping: writing a page of a sparse file
+    // that the disk has no room for raises SIGBUS instead of an error
+#ifdef HAVE_FALLOCATE
+    bool sized = size == 0 ? ftruncate(fd, 0) == 0 : posix_fallocate(fd, 0, off_t(size)) == 0;
+#else
+    bool sized = ftruncate(fd, off_t(size)) == 0;
+#endif
+    void* p = sized && size ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (p != MAP_FAILED) {
+        ptr = static_cast<unsigned char*>(p);
+        mapped = true;
+        path = filename;
+        return true;
+    }
+    if (sized && size == 0)
+        return true;
+#endif
+    // No mapping: fill a buffer and write it out in close()
+    path = filename;
+    buffer.resize(size);
+    ptr = buffer.data();
     return true;
+}
+
+bool MappedOutput::close() {
+    bool ok = true;
+#ifdef HAVE_MMAP
+    if (mapped) {
+        // The pages go to disk with the page cache, like the buffered
+        // path's writes; the blocks were reserved by create()
+        ok = munmap(ptr, length) == 0;
+        if (!ok)
+            cerr << "Error writing file: " << path << endl;
+    }
+#endif
+    if (!mapped && !path.empty()) {
+        ofstream ofs(path, ios::binary);
+        ofs.write(reinterpret_cast<const char*>(ptr), length);
+        ok = static_cast<bool>(ofs);
+        if (!ok)
+            cerr << "Error writing file: " << path << endl;
+    }
+    mapped = false;
+    ptr = nullptr;
+    length = 0;
+    path.clear();
+    buffer.clear();
+    return ok;
 }
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include "myimage.h"
+
+// Streaming codec: the image is processed one restart slice (strip of
+// `restart` MCU rows) at a time, so only a strip of pixels, coefficients and
+// output bytes is held in memory and peak memory grows with the image width,
+// not its area. A strip is laid out as a small padded frame (Y rows, then the
+// stacked U and V rows), which makes its bitstream identical to the
+// corresponding slice of a whole-frame encode with the same -restart.
+//
+// The strips go through a pipeline (runPipeline): reading, color conversion
+// + DCT, entropy coding and writing each run on their own thread and work on
+// consecutive strips at the same time, with a few strips in flight. Decoding
+// runs the same stages in reverse. With one thread (-threads 1, or a single
+// core) the stages run in turn.
+
+// Strips in flight: one per stage, so that every stage has work
+static const int PIPELINE_SLOTS = 4;
+
+// Whether `threads` (0: all cores) allows the stages to run on their own threads
+static bool pipelined(int threads) {
+    return (threads > 0 ? unsigned(threads) : thread::hardware_concurrency()) > 1;
+}
+
+// Buffers of one strip in flight
+struct StripSlot {
+    vector<unsigned char> pixels;   // Padded RGB or gray rows
+    vector<unsigned char> frame;    // YUV rows (decoding)
+    SparseCoefs coef;
+    vector<unsigned char> bytes;    // Entropy coded slice
+    BlockIndex index;
+};
+
+// Read rows [y0, y0 + rows) of a raw image into a padded strip, replicating
+// the last column and the last image row into the padding
+static bool readStrip(istream& is, vector<unsigned char>& strip, int width, int height,
+                      int channels, int pwidth, int y0, int rows) {
+    size_t pitch = size_t(pwidth) * channels;
+    for (int r = 0; r < rows; ++r) {
+        unsigned char* dst = &strip[r * pitch];
+        if (y0 + r >= height) {
+            memcpy(dst, dst - pitch, pitch);
+            continue;
+        }
+        is.read(reinterpret_cast<char*>(dst), size_t(width) * channels);
+        if (!is) {
+            cerr << "Error reading file or file too short." << endl;
+            return false;
+        }
+        for (int x = width; x < pwidth; ++x)
+            memcpy(dst + x * channels, dst + (width - 1) * channels, channels);
+    }
+    return true;
+}
+
+// Color conversion and DCT + quantization of strip rows [0, rows)
+static SparseCoefs transformStrip(const vector<unsigned char>& strip, int pwidth, int rows, Sampling s, int QF) {
+    vector<unsigned char> frame = s == GRAY ? vector<unsigned char>(strip.begin(), strip.begin() + size_t(pwidth) * rows)
+                                            : RGB2YUV(strip, pwidth, rows, s);
+    return quantDct2(frame, QF, rows, pwidth, s);
+}
+
+// With `optimize`, a first pass over the input gathers symbol statistics for
+// optimized Huffman tables; the input is then rewound and encoded for real.
+bool encodeStream(const string& inputFile, const string& outputFile, ImageHeader header, int restart, bool optimize,
+                  int threads) {
+    ifstream fin(inputFile, ios::binary);
+    if (!fin) {
+        cerr << "Failed to open " << inputFile << endl;
+        return false;
+    }
+    ofstream fout(outputFile, ios::binary);
+    if (!fout) {
+        cerr << "Cannot open output file.\n";
+        return false;
+    }
+
+    const Sampling sampling = header.sampling;
+    const bool gray = sampling == GRAY;
+    const int QF = qualityScale(header.quality);
+    const int channels = gray ? 1 : 3;
+    const int mcu = gray ? 8 : 16;
+    const int pwidth = paddedSize(header.width, gray);
+    const int pheight = paddedSize(header.height, gray);
+    const int mcuRows = pheight / mcu;
+    const int nslices = sliceCount(pheight, gray, restart);
+    const bool threaded = pipelined(threads);
+
+    vector<StripSlot> slots(PIPELINE_SLOTS);
+    for (StripSlot& slot : slots)
+        slot.pixels.resize(size_t(pwidth) * restart * mcu * channels);
+    auto sliceMcus = [&](int s, int& mcu0, int& mcu1) {
+        mcu0 = s * restart;
+        mcu1 = min(mcuRows, mcu0 + restart);
+        return (mcu1 - mcu0) * mcu;   // Pixel rows of the strip
+    };
+    auto readStage = [&](int s, int k) {
+        int mcu0, mcu1, rows = sliceMcus(s, mcu0, mcu1);
+        return readStrip(fin, slots[k].pixels, header.width, header.height, channels, pwidth, mcu0 * mcu, rows);
+    };
+    auto transformStage = [&](int s, int k) {
+        int mcu0, mcu1, rows = sliceMcus(s, mcu0, mcu1);
+        slots[k].coef = transformStrip(slots[k].pixels, pwidth, rows, sampling, QF);
+        return true;
+    };
+
+    if (optimize) {
+        SymbolStats stats;
+        bool ok = runPipeline(nslices, PIPELINE_SLOTS, {readStage, transformStage, [&](int s, int k) {
+            int mcu0, mcu1, rows = sliceMcus(s, mcu0, mcu1);
+            DCACslice(slots[k].coef, rows, pwidth, sampling, 0, mcu1 - mcu0, stats);
+            return true;
+        }}, threaded);
+        if (!ok)
+            return false;
+        optimizeTables(header, stats);
+        fin.clear();
+        fin.seekg(0);
+    }
+    EntropyTables tables = headerTables(header);
+
+    // The slice offsets (and block index) are only known at the end: reserve
+    // the header now and rewrite it once all slices are out
+    header.restart = restart;
+    header.sliceOffsets.assign(nslices, 0);
+    writeHeader(fout, header);
+
+    uint32_t offset = 0;
+
+    // Entropy coding of a strip, as the slice it is in the frame
+    auto codeStage = [&](int s, int k) {
+        int mcu0, mcu1, rows = sliceMcus(s, mcu0, mcu1);
+        StripSlot& slot = slots[k];
+        slot.bytes.clear();
+        BitWriter bw(slot.bytes);
+        slot.index = blockIndex(header.index.interval, rows, pwidth, sampling);
+        DCACslice(slot.coef, rows, pwidth, sampling, 0, mcu1 - mcu0, tables, bw,
+                  header.index.interval > 0 ? &slot.index : nullptr);
+        return true;
+    };
+
+    auto writeStage = [&](int s, int k) {
+        int mcu0, mcu1, rows = sliceMcus(s, mcu0, mcu1);
+        StripSlot& slot = slots[k];
+
+        // Move the strip's index rows to the frame rows of the slice
+        if (header.index.interval > 0) {
+            SlicePlanes local = sliceRows(rows, pwidth, sampling, 0, mcu1 - mcu0);
+            SlicePlanes frame = sliceRows(pheight, pwidth, sampling, mcu0, mcu1);
+            for (size_t p = 0; p < local.size(); ++p)
+                for (int r = 0; r < local[p].row1 - local[p].row0; ++r)
+                    header.index.rows[(frame[p].chroma ? pheight / 8 : 0) + frame[p].row0 + r] =
+                        slot.index.rows[(local[p].chroma ? rows / 8 : 0) + local[p].row0 + r];
+            shiftIndex(header.index, pheight, pwidth, sampling, mcu0, mcu1, uint64_t(offset) * 8);
+        }
+
+        header.sliceOffsets[s] = offset;
+        offset += slot.bytes.size();
+        fout.write(reinterpret_cast<const char*>(slot.bytes.data()), slot.bytes.size());
+        return static_cast<bool>(fout);
+    };
+
+    if (!runPipeline(nslices, PIPELINE_SLOTS, {readStage, transformStage, codeStage, writeStage}, threaded))
+        return false;
+
+    fout.seekp(0);
+    writeHeader(fout, header);
+    return static_cast<bool>(fout);
+}
+
+bool decodeStream(const string& inputFile, const string& outputFile, int scale, int threads) {
+    ifstream fin(inputFile, ios::binary);
+    if (!fin) {
+        cerr << "Failed to open input file.\n";
+        return false;
+    }
+
+    ImageHeader header;
+    if (readHeader(fin, header) <= 0)
+        return false;
+    if (header.restart == 0) {
+        cerr << "Streaming decode needs a file encoded with -restart or -stream.\n";
+        return false;
+    }
+
+    const Sampling sampling = header.sampling;
+    const bool gray = sampling == GRAY;
+    const int QF = qualityScale(header.quality);
+    const int channels = gray ? 1 : 3;
+    const int mcu = gray ? 8 : 16;
+    const int pwidth = paddedSize(header.width, gray);
+    const int pheight = paddedSize(header.height, gray);
+    const int mcuRows = pheight / mcu;
+    const int nslices = static_cast<int>(header.sliceOffsets.size());
+    const int swidth = pwidth / scale;                          // Scaled output frame
+    const int outWidth = (header.width + scale - 1) / scale;
+    const int outHeight = (header.height + scale - 1) / scale;
+    EntropyTables tables = headerTables(header);
+
+    streampos dataStart = fin.tellg();
+    fin.seekg(0, ios::end);
+    uint64_t dataSize = uint64_t(fin.tellg() - dataStart);
+    if (header.sliceOffsets.back() > dataSize) {
+        cerr << "Slice table points past the end of the file.\n";
+        return false;
+    }
+    fin.seekg(dataStart);
+
+    ofstream fout(outputFile, ios::binary);
+    if (!fout) {
+        cerr << "Error opening file for writing: " << outputFile << endl;
+        return false;
+    }
+
+    vector<StripSlot> slots(PIPELINE_SLOTS);
+    auto sliceMcus = [&](int s, int& mcu0, int& mcu1) {
+        mcu0 = s * header.restart;
+        mcu1 = min(mcuRows, mcu0 + header.restart);
+        return (mcu1 - mcu0) * mcu;   // Pixel rows of the strip
+    };
+
+    // Read the bytes of a slice
+    auto readStage = [&](int s, int k) {
+        uint64_t end = (s + 1 < nslices) ? header.sliceOffsets[s + 1] : dataSize;
+        slots[k].bytes.resize(end - header.sliceOffsets[s]);
+        if (!fin.read(reinterpret_cast<char*>(slots[k].bytes.data()), slots[k].bytes.size())) {
+            cerr << "Error reading file or file too short." << endl;
+            return false;
+        }
+        return true;
+    };
+
+    // Entropy decoding of the strip
+    auto decodeStage = [&](int s, int k) {
+        int mcu0, mcu1, rows = sliceMcus(s, mcu0, mcu1);
+        StripSlot& slot = slots[k];
+        slot.coef = SparseCoefs(rows, pwidth, sampling);
+        if (!ACDCdecodeSlice(slot.bytes.data(), slot.bytes.size(), slot.coef, rows, pwidth, sampling, 0,
+                             mcu1 - mcu0, tables)) {
+            cerr << "Slice " << s << " could not be decoded.\n";
+            return false;
+        }
+        return true;
+    };
+
+    // Dequantization + IDCT and color conversion of the strip
+    auto transformStage = [&](int s, int k) {
+        int mcu0, mcu1, rows = sliceMcus(s, mcu0, mcu1);
+        StripSlot& slot = slots[k];
+        vector<unsigned char>& frame = gray ? slot.pixels : slot.frame;
+        frame.resize(frameSamples(rows / scale, swidth, sampling));
+        iquantDct2Rows(slot.coef, frame, QF, rows, pwidth, sampling, 0, mcu1 - mcu0, scale);
+        if (!gray) {
+            slot.pixels.resize(size_t(swidth) * (rows / scale) * 3);
+            YUV2RGB(slot.frame.data(), swidth, rows / scale, sampling, slot.pixels.data());
+        }
+        return true;
+    };
+
+    // Write the image rows of the strip, dropping the MCU padding
+    auto writeStage = [&](int s, int k) {
+        int mcu0, mcu1, rows = sliceMcus(s, mcu0, mcu1);
+        const vector<unsigned char>& frame = slots[k].pixels;
+        for (int r = 0; r < rows / scale && (mcu0 * mcu) / scale + r < outHeight; ++r)
+            fout.write(reinterpret_cast<const char*>(&frame[size_t(r) * swidth * channels]),
+                       size_t(outWidth) * channels);
+        return static_cast<bool>(fout);
+    };
+
+    if (!runPipeline(nslices, PIPELINE_SLOTS, {readStage, decodeStage, transformStage, writeStage},
+                     pipelined(threads)))
+        return false;
+
+    cout << "Saved raw image to: " << outputFile << endl;
+    return static_cast<bool>(fout);
+}
\ No newline at end of file
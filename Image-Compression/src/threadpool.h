@@ -0,0 +1,191 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads.
+// parallelFor() hands out indices [0, count) one at a time to the workers and
+// the calling thread, and returns when every index has been processed.
+// parallelForWorker() also passes the number of the thread running each index
+// (0 for the caller, 1 to size() - 1 for the workers), for per-thread state.
+// Only one parallelFor() may run on a pool at a time.
+class ThreadPool {
+public:
+    // threads <= 0 uses one thread per hardware core
+    explicit ThreadPool(int threads = 0) {
+        if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        for (int i = 1; i < threads; ++i)  // The caller is the remaining thread
+            workers.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stop = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    void parallelFor(int count, const std::function<void(int)>& fn) {
+        parallelForWorker(count, [&fn](int i, int) { fn(i); });
+    }
+
+    void parallelForWorker(int count, const std::function<void(int, int)>& fn) {
+        if (count <= 0) return;
+        std::unique_lock<std::mutex> lock(m);
+        job = &fn;
+        total = count;
+        next = 0;
+        running = 0;
+        ++generation;
+        wake.notify_all();
+        runJobs(lock, 0);
+        finished.wait(lock, [this] { return next >= total && running == 0; });
+        job = nullptr;
+    }
+
+private:
+    // Take indices until none are left; called with the lock held
+    void runJobs(std::unique_lock<std::mutex>& lock, int worker) {
+        while (job && next < total) {
+            int i = next++;
+            ++running;
+            const std::function<void(int, int)>* fn = job;
+            lock.unlock();
+            (*fn)(i, worker);
+            lock.lock();
+            if (--running == 0 && next >= total) finished.notify_all();
+        }
+    }
+
+    void workerLoop(int worker) {
+        std::unique_lock<std::mutex> lock(m);
+        unsigned long seen = 0;
+        for (;;) {
+            wake.wait(lock, [&] { return stop || generation != seen; });
+            if (stop) return;
+            seen = generation;
+            runJobs(lock, worker);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex m;
+    std::condition_variable wake, finished;
+    const std::function<void(int, int)>* job = nullptr;
+    int total = 0, next = 0, running = 0;
+    unsigned long generation = 0;
+    bool stop = false;
+};
+
+// Bounded FIFO between two pipeline stages. push() waits while the queue is
+// full and pop() while it is empty. close() wakes both sides: push() then
+// fails, and pop() fails once the queue is drained.
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(m);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(m);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(m);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    std::mutex m;
+    std::condition_variable notFull, notEmpty;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+};
+
+// Pass items [0, count) through `stages` in order. Each stage runs on its own
+// thread (the last one on the caller) and hands items to the next through a
+// bounded queue, so the stages work on consecutive items at the same time and
+// the time per item approaches that of the slowest stage. Every stage sees
+// the items in order. At most `slots` items are in flight: stage(item, slot)
+// works on the buffers of `slot`, which is reused once the last stage is done
+// with it. A stage returning false stops the pipeline, and runPipeline()
+// then returns false. With `threaded` false each item goes through all the
+// stages on the caller before the next one starts.
+inline bool runPipeline(int count, int slots, const std::vector<std::function<bool(int, int)>>& stages,
+                        bool threaded = true) {
+    const int nstages = static_cast<int>(stages.size());
+    if (!threaded || nstages < 2) {
+        for (int i = 0; i < count; ++i)
+            for (const std::function<bool(int, int)>& stage : stages)
+                if (!stage(i, 0)) return false;
+        return true;
+    }
+
+    // queues[0] holds the free slots, queues[k] the (item, slot) pairs that
+    // stage k - 1 has finished
+    std::vector<std::unique_ptr<BoundedQueue<std::pair<int, int>>>> queues;
+    for (int k = 0; k < nstages; ++k)
+        queues.emplace_back(new BoundedQueue<std::pair<int, int>>(slots));
+    for (int s = 0; s < slots; ++s)
+        queues[0]->push({-1, s});
+
+    std::atomic<bool> failed(false);
+    auto fail = [&] {
+        failed = true;
+        for (auto& q : queues) q->close();
+    };
+    auto runStage = [&](int k) {
+        std::pair<int, int> job;
+        for (int i = 0; k > 0 || i < count; ++i) {
+            if (!queues[k]->pop(job) || failed) break;
+            if (k == 0) job.first = i;
+            if (!stages[k](job.first, job.second)) {
+                fail();
+                break;
+            }
+            queues[(k + 1) % nstages]->push(job);   // The last stage frees the slot
+        }
+        if (k + 1 < nstages) queues[k + 1]->close();   // No more items for the next stage
+    };
+
+    std::vector<std::thread> threads;
+    for (int k = 0; k + 1 < nstages; ++k)
+        threads.emplace_back(runStage, k);
+    runStage(nstages - 1);
+    for (std::thread& t : threads) t.join();
+    return !failed;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include <chrono>
+#include <future>
+
+#include "../src/codec.h"
+
+// Regression tests for crafted and corrupt files: each must fail to decode,
+// promptly, instead of hanging or reading out of bounds. Prints one line per
+// case and exits with 1 if any case fails.
+//
+// g++ ./tests/corrupt.cpp ./src/*.cpp -o corrupt.exe -std=c++17 -pthread
+
+// Decode `file`; true if the decoder rejects it within a few seconds
+static bool rejected(const vector<unsigned char>& file) {
+    auto result = async(launch::async, [&] {
+        Decoder dec;
+        ImageHeader info;
+        if (!dec.readInfo(file.data(), file.size(), info))
+            return size_t(0);
+        vector<unsigned char> pixels(Decoder::decodedSize(info));
+        return dec.decode(file.data(), file.size(), pixels.data(), pixels.size());
+    });
+    if (result.wait_for(chrono::seconds(10)) == future_status::timeout) {
+        cerr << "decoder does not return\n";
+        _Exit(1);   // The decoding thread cannot be stopped
+    }
+    return result.get() == 0;
+}
+
+// 8x8 gray image whose custom AC table gives ZRL the all-zero code: the
+// zero padding after the last byte of the bitstream reads as endless ZRLs
+static vector<unsigned char> zrlHuffman() {
+    ImageHeader hdr;
+    hdr.width = hdr.height = 8;
+    hdr.sampling = GRAY;
+    hdr.customTables = true;
+    hdr.huffman[0].bits[1] = 1;   // DC: category 0 only
+    hdr.huffman[0].vals = {0};
+    hdr.huffman[1].bits[1] = 1;   // AC: ZRL "0", EOB "10"
+    hdr.huffman[1].bits[2] = 1;
+    hdr.huffman[1].vals = {165, 0};
+    vector<unsigned char> file;
+    writeHeader(file, hdr);
+    file.push_back(0);
+    return file;
+}
+
+// 8x8 gray rANS file whose first AC context holds only ZRL: with a single
+// symbol of frequency 4096 the states never change, so every AC symbol
+// decodes as ZRL without reading a byte
+static vector<unsigned char> zrlRans() {
+    ImageHeader hdr;
+    hdr.width = hdr.height = 8;
+    hdr.sampling = GRAY;
+    hdr.coder = RANS;
+    hdr.rans.freq[dcContext(false)].assign(DC_SYMBOLS, 0);
+    hdr.rans.freq[dcContext(false)][0] = 1 << RANS_SCALE_BITS;
+    hdr.rans.freq[acContext(false, 0)].assign(AC_SYMBOLS, 0);
+    hdr.rans.freq[acContext(false, 0)][165] = 1 << RANS_SCALE_BITS;
+    vector<unsigned char> file;
+    writeHeader(file, hdr);
+    for (int k = 0; k < RANS_STATES; ++k)
+        file.insert(file.end(), {0, 0, 0, 1});   // Valid start states
+    return file;
+}
+
+// rANS file cut inside its start states
+static vector<unsigned char> truncatedRans() {
+    vector<unsigned char> file = zrlRans();
+    file.resize(file.size() - 4 * RANS_STATES + 2);
+    return file;
+}
+
+int main() {
+    struct Case {
+        const char* name;
+        vector<unsigned char> file;
+    } cases[] = {
+        {"Huffman ZRL past the end of the block", zrlHuffman()},
+        {"rANS ZRL past the end of the block", zrlRans()},
+        {"rANS stream shorter than its start states", truncatedRans()},
+    };
+
+    int failed = 0;
+    for (const Case& c : cases) {
+        bool ok = rejected(c.file);
+        cout << (ok ? "ok    " : "FAIL  ") << c.name << endl;
+        failed += !ok;
+    }
+    return failed ? 1 : 0;
+}
\ No newline at end of file